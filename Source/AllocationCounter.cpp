@@ -0,0 +1,124 @@
+//
+//  AllocationCounter.cpp
+//  Bound - App
+//
+
+#include "AllocationCounter.h"
+
+#if BOUND_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+#if JUCE_WINDOWS
+ #include <malloc.h>
+#endif
+
+static thread_local int numAllocations = 0;
+static thread_local bool isIgnored = false;
+static std::atomic<long long> totalNumAllocations (0);
+
+int AllocationCounter::getNumAllocations()
+{
+    return numAllocations;
+}
+
+long long AllocationCounter::getTotalNumAllocations()
+{
+    return totalNumAllocations.load();
+}
+
+void AllocationCounter::ignoreThisThread()
+{
+    isIgnored = true;
+}
+
+static void* allocate (std::size_t size) noexcept
+{
+    ++numAllocations;
+
+    if (! isIgnored)
+        ++totalNumAllocations;
+
+    return std::malloc (size == 0 ? 1 : size);
+}
+
+void* operator new (std::size_t size)
+{
+    if (void* p = allocate (size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)
+{
+    return operator new (size);
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept     { return allocate (size); }
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept   { return allocate (size); }
+
+void operator delete (void* p) noexcept                                   { std::free (p); }
+void operator delete[] (void* p) noexcept                                 { std::free (p); }
+void operator delete (void* p, std::size_t) noexcept                      { std::free (p); }
+void operator delete[] (void* p, std::size_t) noexcept                    { std::free (p); }
+void operator delete (void* p, const std::nothrow_t&) noexcept            { std::free (p); }
+void operator delete[] (void* p, const std::nothrow_t&) noexcept          { std::free (p); }
+
+// C++17のアラインつきnew。alignasで大きくアラインした型をnewしたときに呼ばれる
+#if defined (__cpp_aligned_new)
+
+static void* allocateAligned (std::size_t size, std::align_val_t alignment) noexcept
+{
+    ++numAllocations;
+
+    if (! isIgnored)
+        ++totalNumAllocations;
+
+    const std::size_t align = (std::size_t) alignment < sizeof (void*) ? sizeof (void*) : (std::size_t) alignment;
+
+   #if JUCE_WINDOWS
+    return _aligned_malloc (size == 0 ? 1 : size, align);
+   #else
+    void* p = nullptr;
+    return posix_memalign (&p, align, size == 0 ? 1 : size) == 0 ? p : nullptr;
+   #endif
+}
+
+static void freeAligned (void* p) noexcept
+{
+   #if JUCE_WINDOWS
+    _aligned_free (p);
+   #else
+    std::free (p);
+   #endif
+}
+
+void* operator new (std::size_t size, std::align_val_t alignment)
+{
+    if (void* p = allocateAligned (size, alignment))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size, std::align_val_t alignment)
+{
+    return operator new (size, alignment);
+}
+
+void* operator new (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept    { return allocateAligned (size, alignment); }
+void* operator new[] (std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept  { return allocateAligned (size, alignment); }
+
+void operator delete (void* p, std::align_val_t) noexcept                                   { freeAligned (p); }
+void operator delete[] (void* p, std::align_val_t) noexcept                                 { freeAligned (p); }
+void operator delete (void* p, std::size_t, std::align_val_t) noexcept                      { freeAligned (p); }
+void operator delete[] (void* p, std::size_t, std::align_val_t) noexcept                    { freeAligned (p); }
+void operator delete (void* p, std::align_val_t, const std::nothrow_t&) noexcept            { freeAligned (p); }
+void operator delete[] (void* p, std::align_val_t, const std::nothrow_t&) noexcept          { freeAligned (p); }
+
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+//
+//  AllocationCounter.h
+//  Bound - App
+//
+//  ゲームのtick中にヒープ確保が起きていないかを調べるためのフック。
+//  BOUND_COUNT_ALLOCATIONS=1でビルドするとoperator newを差し替えて、スレッドごとに確保回数を数える。
+//
+
+#pragma once
+
+#ifndef BOUND_COUNT_ALLOCATIONS
+ #define BOUND_COUNT_ALLOCATIONS 0
+#endif
+
+#if BOUND_COUNT_ALLOCATIONS
+
+#include "JuceHeader.h"
+
+namespace AllocationCounter
+{
+    int getNumAllocations();            // このスレッドでのoperator newの回数
+    long long getTotalNumAllocations(); // 全部のスレッドでの回数。ワーカースレッドのぶんも入る
+
+    // このスレッドの確保はgetTotalNumAllocationsに入れない。tickの外で動くスレッド(MIDIの送信など)から呼ぶ
+    void ignoreThisThread();
+
+    // スコープを抜けるまでにこのスレッドで確保が起きたらjassertで止める
+    struct ScopedNoAllocations
+    {
+        ScopedNoAllocations (bool shouldCheck = true) : enabled (shouldCheck), start (getNumAllocations()) {}
+        ~ScopedNoAllocations()
+        {
+            if (enabled)
+                jassert (getNumAllocations() == start);
+        }
+
+        int getNumAllocationsSoFar() const { return getNumAllocations() - start; }
+
+        bool enabled;
+        int start;
+    };
+}
+
+ #define BOUND_ASSERT_NO_ALLOCATIONS(shouldCheck) AllocationCounter::ScopedNoAllocations noAllocationsCheck (shouldCheck)
+#else
+ #define BOUND_ASSERT_NO_ALLOCATIONS(shouldCheck)
+#endif
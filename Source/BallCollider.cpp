@@ -0,0 +1,330 @@
+//
+//  BallCollider.cpp
+//  Bound - App
+//
+
+#include "BallCollider.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace game;
+
+BallCollider::BallCollider()
+{
+}
+
+void BallCollider::setCapacity(size_t n)
+{
+    capacity = n;
+
+    size_t numBuckets = 64;
+    while (numBuckets < n * 4) numBuckets <<= 1;
+
+    bucketStart.reserve(numBuckets + 1);
+    bucketFill.reserve(numBuckets);
+    entries.reserve(n * RESERVED_CELLS_PER_BALL);
+    ranges.reserve(n);
+    motions.reserve(n);
+    wideBalls.reserve(n);
+    found.reserve(n * MAX_CONTACTS_PER_BALL);
+    resolved.reserve(n);
+    collided.reserve(n);
+}
+
+void BallCollider::setRadius(float r)
+{
+    radius = std::max(0.01f, r);
+}
+
+void BallCollider::clear()
+{
+    entries.clear();
+    ranges.clear();
+    wideBalls.clear();
+}
+
+int BallCollider::collide(BallStore &store)
+{
+    const size_t n = store.size();
+    numPairsTested = 0;
+    numDropped = 0;
+    found.clear();
+    resolved.clear();
+    wideBalls.clear();
+
+    if (n < 2) return 0;
+
+    motions.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        motions[i].px = store.px[i];
+        motions[i].py = store.py[i];
+        motions[i].vx = store.vx[i];
+        motions[i].vy = store.vy[i];
+    }
+
+    if (useGrid)
+    {
+        // マスは直径。ボール1つがだいたい2x2マスに入り、1つのマスにはとなりあうボールしかいない
+        const float needed = radius * 2;
+        const size_t minBuckets = std::max(n, capacity) * 4;
+
+        if (needed != cellSize || bucketFill.size() < minBuckets)
+        {
+            rebuild(needed, minBuckets);
+        }
+
+        fill(store);
+        findContactsInGrid();
+        findContactsOfWideBalls();
+    }
+    else
+    {
+        findContactsBruteForce();
+    }
+
+    resolve(store);
+    return (int)resolved.size();
+}
+
+void BallCollider::rebuild(float newCellSize, size_t minBuckets)
+{
+    cellSize = newCellSize;
+    invCellSize = 1.f / newCellSize;
+
+    size_t numBuckets = 64;
+    while (numBuckets < minBuckets) numBuckets <<= 1;
+    bucketStart.assign(numBuckets + 1, 0);
+    bucketFill.assign(numBuckets, 0);
+}
+
+int BallCollider::toCell(float p) const
+{
+    const float c = std::floor(p * invCellSize);
+    return (int)std::min(std::max(c, -1.0e6f), 1.0e6f);
+}
+
+uint32_t BallCollider::bucketOf(int cellX, int cellY) const
+{
+    const uint32_t h = ((uint32_t)cellX * 73856093u) ^ ((uint32_t)cellY * 19349663u);
+    return h & (uint32_t)(bucketFill.size() - 1);
+}
+
+// 掃く範囲を出して、かかるマスの数をバケツごとに数え、先頭を決めてから添字の順に並べる。
+// バケツの中は添字の昇順になる
+void BallCollider::fill(const BallStore &store)
+{
+    const size_t n = store.size();
+    const size_t numBuckets = bucketFill.size();
+    const size_t budget = capacity > 0 ? capacity * RESERVED_CELLS_PER_BALL : std::numeric_limits<size_t>::max();
+    size_t numEntries = 0;
+
+    ranges.resize(n);
+    std::fill(bucketStart.begin(), bucketStart.end(), 0);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const Motion &m = motions[i];
+        CellRange &range = ranges[i];
+        range.x0 = toCell(std::min(m.px, m.px + m.vx) - radius);
+        range.x1 = toCell(std::max(m.px, m.px + m.vx) + radius);
+        range.y0 = toCell(std::min(m.py, m.py + m.vy) - radius);
+        range.y1 = toCell(std::max(m.py, m.py + m.vy) + radius);
+
+        const int64_t numCells = (int64_t)(range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1);
+        range.wide = numCells > MAX_CELLS_PER_BALL || numEntries + (size_t)numCells > budget;
+
+        if (range.wide)
+        {
+            wideBalls.push_back((int)i);
+            continue;
+        }
+
+        numEntries += (size_t)numCells;
+
+        for (int cellY = range.y0; cellY <= range.y1; cellY++)
+        {
+            for (int cellX = range.x0; cellX <= range.x1; cellX++)
+            {
+                bucketStart[bucketOf(cellX, cellY) + 1]++;
+            }
+        }
+    }
+
+    for (size_t b = 0; b < numBuckets; b++)
+    {
+        bucketStart[b + 1] += bucketStart[b];
+        bucketFill[b] = bucketStart[b];
+    }
+
+    entries.resize(numEntries);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const CellRange &range = ranges[i];
+        if (range.wide) continue;
+
+        for (int cellY = range.y0; cellY <= range.y1; cellY++)
+        {
+            for (int cellX = range.x0; cellX <= range.x1; cellX++)
+            {
+                Entry &entry = entries[bucketFill[bucketOf(cellX, cellY)]++];
+                entry.cellX = cellX;
+                entry.cellY = cellY;
+                entry.x0 = range.x0;
+                entry.y0 = range.y0;
+                entry.index = (int)i;
+            }
+        }
+    }
+}
+
+void BallCollider::findContactsInGrid()
+{
+    const size_t numBuckets = bucketFill.size();
+
+    for (size_t bucket = 0; bucket < numBuckets; bucket++)
+    {
+        const int end = bucketStart[bucket + 1];
+
+        for (int e = bucketStart[bucket]; e < end; e++)
+        {
+            const Entry &entry = entries[e];
+
+            // バケツの中は添字の昇順なので、うしろにいるものはみんな添字が大きい
+            for (int k = e + 1; k < end; k++)
+            {
+                // 同じバケツに入っているほかのマスのボールは飛ばす
+                const Entry &other = entries[k];
+                if (other.cellX != entry.cellX || other.cellY != entry.cellY) continue;
+
+                // 2つが共有するマスのうち一番左上のマスでだけ調べる。ほかの共有するマスでは飛ばす
+                if (entry.cellX != std::max(entry.x0, other.x0) || entry.cellY != std::max(entry.y0, other.y0)) continue;
+
+                test(entry.index, motions[entry.index], other.index, motions[other.index]);
+            }
+        }
+    }
+}
+
+// グリッドに入れなかったボールは、掃く範囲のマスが重なるボールと全部調べる。
+// 両方ともグリッドに入れなかった組は、添字の小さいほうから見たときだけ調べる
+void BallCollider::findContactsOfWideBalls()
+{
+    const int n = (int)ranges.size();
+
+    for (int a : wideBalls)
+    {
+        const CellRange &ra = ranges[a];
+
+        for (int b = 0; b < n; b++)
+        {
+            const CellRange &rb = ranges[b];
+            if (b == a || (rb.wide && b < a)) continue;
+            if (rb.x1 < ra.x0 || rb.x0 > ra.x1 || rb.y1 < ra.y0 || rb.y0 > ra.y1) continue;
+
+            if (a < b) test(a, motions[a], b, motions[b]);
+            else test(b, motions[b], a, motions[a]);
+        }
+    }
+}
+
+void BallCollider::findContactsBruteForce()
+{
+    const int n = (int)motions.size();
+
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i + 1; j < n; j++)
+        {
+            test(i, motions[i], j, motions[j]);
+        }
+    }
+}
+
+// 2つの円が1ターンの間に最初に触れる時刻。|d + w t| = 2rを解く
+void BallCollider::test(int a, const Motion &ma, int b, const Motion &mb)
+{
+    numPairsTested++;
+
+    const float dx = mb.px - ma.px, dy = mb.py - ma.py;
+    const float wx = mb.vx - ma.vx, wy = mb.vy - ma.vy;
+    const float reach = radius * 2;
+
+    const float approach = dx * wx + dy * wy;
+    if (approach >= 0) return; // 離れていく(止まっている)
+
+    const float c = dx * dx + dy * dy - reach * reach;
+    float t = 0;
+
+    if (c > 0)
+    {
+        const float ww = wx * wx + wy * wy;
+        const float disc = approach * approach - ww * c;
+        if (disc < 0) return;
+
+        t = (-approach - std::sqrt(disc)) / ww;
+        if (t > 1) return;
+    }
+
+    if (capacity > 0 && found.size() >= capacity * MAX_CONTACTS_PER_BALL)
+    {
+        numDropped++;
+        return;
+    }
+
+    BallContact contact;
+    contact.a = a;
+    contact.b = b;
+    contact.time = t;
+    found.push_back(contact);
+}
+
+void BallCollider::resolve(BallStore &store)
+{
+    // 見つけた順はグリッドの中の並びで変わるので、時刻と添字で並べる
+    std::sort(found.begin(), found.end(), [] (const BallContact &x, const BallContact &y)
+    {
+        if (x.time != y.time) return x.time < y.time;
+        if (x.a != y.a) return x.a < y.a;
+        return x.b < y.b;
+    });
+
+    collided.assign(store.size(), 0);
+
+    for (auto &contact : found)
+    {
+        const int a = contact.a, b = contact.b;
+        if (collided[a] || collided[b]) continue;
+
+        const float t = contact.time;
+
+        // ぶつかった時刻での中心を結ぶ向き
+        float nx = (store.px[b] + store.vx[b] * t) - (store.px[a] + store.vx[a] * t);
+        float ny = (store.py[b] + store.vy[b] * t) - (store.py[a] + store.vy[a] * t);
+        const float length = std::sqrt(nx * nx + ny * ny);
+        if (length <= 0) continue;
+
+        nx /= length;
+        ny /= length;
+
+        const float dv = (store.vx[b] - store.vx[a]) * nx + (store.vy[b] - store.vy[a]) * ny;
+        if (dv >= 0) continue;
+
+        // 向きの成分だけ入れ替える
+        store.vx[a] += dv * nx;
+        store.vy[a] += dv * ny;
+        store.vx[b] -= dv * nx;
+        store.vy[b] -= dv * ny;
+
+        // このあと新しい速度で1ターン進めても、tまでは古い速度で進んだ位置に着くように戻しておく
+        store.px[a] -= dv * nx * t;
+        store.py[a] -= dv * ny * t;
+        store.px[b] += dv * nx * t;
+        store.py[b] += dv * ny * t;
+
+        collided[a] = collided[b] = 1;
+        resolved.push_back(contact);
+    }
+}
@@ -0,0 +1,122 @@
+//
+//  BallCollider.h
+//  Bound - App
+//
+//  ボール同士の衝突。
+//  広い判定は一様グリッドの空間ハッシュ。マスの大きさはボールの直径で、速さには合わせない。
+//  ボールは1ターンに掃く範囲(始めと終わりの位置を囲む四角を半径だけ広げたもの)がかかるマス全部に入れる。
+//  そのターンにぶつかる2つは掃く範囲が重なるので、どこかのマスを共有している。組は共有するマスのうち
+//  一番左上のマスでだけ調べるので、1組1回になる。速いボールは多くのマスに入るだけで、ほかのボールのマスは増えない。
+//  MAX_CELLS_PER_BALLより多くのマスにかかるボールはグリッドに入れず、範囲が重なるボールと直接調べる。
+//  バケツは毎ターン数えて並べ直す(数え上げソート)。掃く範囲は速度でターンごとに変わるので、つなぎなおしても得がない。
+//  細かい判定は1ターンぶんの移動を線分として、2つの円が最初に触れる時刻を出す(掃引判定)。
+//  ぶつかった組は時刻順に、1ターンに1ボール1回だけ、等質量の弾性衝突として速度を変える。
+//
+//  collideはボードごとに1スレッドでやる(ボード同士は並列)。64x64の盤面では、driftで4万個くらい、
+//  flickで1万数千個くらいまでがDEFAULT_TICK_INTERVAL_MSに収まる(--benchmark-collisions)。
+//  ボールが重なりあうほど詰まると組の数がボールの数に比例しなくなるので、それより多いときは衝突を切るか、ターンを長くすること。
+//
+#pragma once
+
+#include <vector>
+#include "BallStore.h"
+
+#define DEFAULT_BALL_RADIUS 0.5f   // マス単位。となりのマスのボールとちょうど触れる
+#define MAX_CONTACTS_PER_BALL 8    // 固定容量モードで1ターンにためておける組の数(ボールあたり)
+#define MAX_CELLS_PER_BALL 100     // 掃く範囲がこれより多くのマスにかかるボールはグリッドに入れない(1ターンに9マス以上進むもの)
+#define RESERVED_CELLS_PER_BALL 16 // 固定容量モードでボールあたりにとっておくマスの数。使いきったらあとのボールはグリッドに入れない
+
+NAMESPACE_GAME_BEGIN
+
+struct BallContact
+{
+    int a, b;   // BallStore内の添字。a < b
+    float time; // ターンの中でぶつかった時刻(0 - 1)
+};
+
+class BallCollider
+{
+public:
+    BallCollider();
+
+    // n個ぶん先に確保して、それ以上はためない(固定容量モード)。0なら必要なだけ確保する
+    void setCapacity(size_t n);
+
+    void setRadius(float radius);
+    float getRadius() const { return radius; }
+
+    // falseにすると全部の組を調べる。比較用
+    void setUseGrid(bool shouldUseGrid) { useGrid = shouldUseGrid; }
+
+    // storeの位置から速度のまま1ターン進めたときにぶつかる組を見つけて、速度を変える。
+    // 位置は、このあとstepBallsで進めたときにぶつかった時刻から向きを変えたことになるようにずらしておく。
+    // 変えた組の数を返す。組はgetContactsで引ける(時刻順)
+    int collide(BallStore &store);
+
+    const BallContact* getContacts() const { return resolved.data(); }
+    int getNumContacts() const { return (int)resolved.size(); }
+
+    // 前のcollideで細かい判定をした組の数と、ためきれずに捨てた組の数
+    int64_t getNumPairsTested() const { return numPairsTested; }
+    int getNumContactsDropped() const { return numDropped; }
+
+    // 前のcollideでグリッドに入れずに全部のボールと比べたボールの数
+    int getNumWideBalls() const { return (int)wideBalls.size(); }
+
+    // グリッドを空にする。ボールを全部消したとき(毎ターン並べ直すので、持っているものを捨てるだけ)
+    void clear();
+
+private:
+    // collideの最初の時点での位置と速度
+    struct Motion
+    {
+        float px, py, vx, vy;
+    };
+
+    // ボールが掃く範囲にかかるマス(両端を含む)
+    struct CellRange
+    {
+        int x0, y0, x1, y1;
+        bool wide; // グリッドに入れなかった
+    };
+
+    // バケツに並べるもの。同じバケツにほかのマスのボールも入るのでマスも持つ。
+    // 組を調べるマスを決めるのに範囲の左上も写しておく(rangesを引きにいかなくていいように)
+    struct Entry
+    {
+        int cellX, cellY;
+        int x0, y0;
+        int index; // このターンのBallStoreの添字
+    };
+
+    void rebuild(float newCellSize, size_t minBuckets);
+    void fill(const BallStore &store);
+    uint32_t bucketOf(int cellX, int cellY) const;
+    int toCell(float p) const;
+
+    void findContactsInGrid();
+    void findContactsOfWideBalls();
+    void findContactsBruteForce();
+    void test(int a, const Motion &ma, int b, const Motion &mb); // a < b
+    void resolve(BallStore &store);
+
+    float radius = DEFAULT_BALL_RADIUS;
+    float cellSize = 0, invCellSize = 0;
+    bool useGrid = true;
+    size_t capacity = 0;
+
+    std::vector<int> bucketStart;   // バケツごとのentriesの先頭。最後にひとつ多い。バケツの数は2の累乗
+    std::vector<int> bucketFill;    // 並べるときの書く位置
+    std::vector<Entry> entries;     // バケツの順
+    std::vector<CellRange> ranges;  // 添字ごと
+    std::vector<Motion> motions;    // 同上
+    std::vector<int> wideBalls;     // グリッドに入れなかったボールの添字(昇順)
+    std::vector<BallContact> found; // 細かい判定で当たった組
+    std::vector<BallContact> resolved;
+    std::vector<char> collided;     // 添字ごと。このターンにもうぶつかったか
+
+    int64_t numPairsTested = 0;
+    int numDropped = 0;
+};
+
+NAMESPACE_GAME_END
@@ -0,0 +1,360 @@
+//
+//  BallStore.cpp
+//  Bound - App
+//
+
+#include "BallStore.h"
+#include "Game.h"
+
+#if defined (__AVX__)
+ #include <immintrin.h>
+ #define BOUND_USE_AVX 1
+#elif defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define BOUND_USE_SSE 1
+#endif
+
+using namespace game;
+
+void BallStore::reserve(size_t n)
+{
+    px.reserve(n); py.reserve(n);
+    vx.reserve(n); vy.reserve(n);
+    r.reserve(n); g.reserve(n); b.reserve(n);
+    lifespan.reserve(n);
+    id.reserve(n);
+    noteNum.reserve(n);
+    slotOf.reserve(n);
+    slots.reserve(n);
+}
+
+void BallStore::setCapacity(size_t n)
+{
+    capacity = n;
+    reserve(n);
+}
+
+BallHandle BallStore::push(const Ball &ball)
+{
+    if (full()) return BallHandle::invalid();
+
+    uint32_t s;
+    if (freeSlot != 0xffffffff)
+    {
+        s = freeSlot;
+        freeSlot = slots[s].index;
+    }
+    else
+    {
+        s = (uint32_t)slots.size();
+        Slot slot;
+        slot.generation = 0;
+        slots.push_back(slot);
+    }
+
+    slots[s].index = (uint32_t)size();
+    slots[s].generation++;
+    slotOf.push_back(s);
+
+    px.push_back(ball.px); py.push_back(ball.py);
+    vx.push_back(ball.vx); vy.push_back(ball.vy);
+    r.push_back(ball.r); g.push_back(ball.g); b.push_back(ball.b);
+    lifespan.push_back(ball.lifespan);
+    id.push_back(ball.id);
+    noteNum.push_back(ball.noteNum);
+
+    BallHandle h;
+    h.index = s;
+    h.generation = slots[s].generation;
+    return h;
+}
+
+Ball BallStore::get(size_t i) const
+{
+    Ball ball;
+    ball.px = px[i]; ball.py = py[i];
+    ball.vx = vx[i]; ball.vy = vy[i];
+    ball.r = r[i]; ball.g = g[i]; ball.b = b[i];
+    ball.lifespan = lifespan[i];
+    ball.id = id[i];
+    ball.noteNum = noteNum[i];
+    return ball;
+}
+
+void BallStore::set(size_t i, const Ball &ball)
+{
+    px[i] = ball.px; py[i] = ball.py;
+    vx[i] = ball.vx; vy[i] = ball.vy;
+    r[i] = ball.r; g[i] = ball.g; b[i] = ball.b;
+    lifespan[i] = ball.lifespan;
+    id[i] = ball.id;
+    noteNum[i] = ball.noteNum;
+}
+
+void BallStore::erase(size_t i)
+{
+    const uint32_t s = slotOf[i];
+    slots[s].generation++;
+    slots[s].index = freeSlot;
+    freeSlot = s;
+
+    const size_t last = size() - 1;
+    if (i != last)
+    {
+        moveBall(last, i);
+    }
+    popBack();
+}
+
+void BallStore::eraseIf(const char *remove)
+{
+    // 後ろから消すので、末尾から持ってくるボールは必ず残すボール
+    for (size_t i = size(); i-- > 0;)
+    {
+        if (remove[i]) erase(i);
+    }
+}
+
+void BallStore::clear()
+{
+    for (size_t i = 0; i < size(); i++)
+    {
+        const uint32_t s = slotOf[i];
+        slots[s].generation++;
+        slots[s].index = freeSlot;
+        freeSlot = s;
+    }
+
+    px.clear(); py.clear();
+    vx.clear(); vy.clear();
+    r.clear(); g.clear(); b.clear();
+    lifespan.clear();
+    id.clear();
+    noteNum.clear();
+    slotOf.clear();
+}
+
+int BallStore::indexOf(BallHandle h) const
+{
+    if (h.index >= slots.size() || slots[h.index].generation != h.generation || (h.generation & 1) == 0)
+    {
+        return -1;
+    }
+
+    return (int)slots[h.index].index;
+}
+
+BallHandle BallStore::getHandle(size_t i) const
+{
+    BallHandle h;
+    h.index = slotOf[i];
+    h.generation = slots[h.index].generation;
+    return h;
+}
+
+bool BallStore::remove(BallHandle h)
+{
+    const int i = indexOf(h);
+    if (i < 0) return false;
+
+    erase(i);
+    return true;
+}
+
+void BallStore::moveBall(size_t from, size_t to)
+{
+    px[to] = px[from]; py[to] = py[from];
+    vx[to] = vx[from]; vy[to] = vy[from];
+    r[to] = r[from]; g[to] = g[from]; b[to] = b[from];
+    lifespan[to] = lifespan[from];
+    id[to] = id[from];
+    noteNum[to] = noteNum[from];
+    slotOf[to] = slotOf[from];
+    slots[slotOf[to]].index = (uint32_t)to;
+}
+
+void BallStore::popBack()
+{
+    px.pop_back(); py.pop_back();
+    vx.pop_back(); vy.pop_back();
+    r.pop_back(); g.pop_back(); b.pop_back();
+    lifespan.pop_back();
+    id.pop_back();
+    noteNum.pop_back();
+    slotOf.pop_back();
+}
+
+//==============================================================================
+// Board::moveの判定をそのまま式にしたもの。
+//   x方向の反射: isWall(px + vx, py) || isWall(px - vx, py)
+//   y方向の反射: isWall(px, py + vy) || isWall(px, py - vy)
+//   ワープ:      isWarpZone(px + vx, py + vy)
+static inline bool outside(float v, float lo, float hi)
+{
+    return v < lo || v > hi;
+}
+
+int game::stepBallsScalar(BallStore &s, size_t begin, size_t end,
+                          const WallBounds &w, const WallBounds &wp,
+                          BallHit *hits, int numHits, int *warps, int &numWarps)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const float x = s.px[i], y = s.py[i];
+        float dx = s.vx[i], dy = s.vy[i];
+
+        const bool hitX = outside(x + dx, w.xMin, w.xMax) || outside(x - dx, w.xMin, w.xMax) || outside(y, w.yMin, w.yMax);
+        const bool hitY = outside(y + dy, w.yMin, w.yMax) || outside(y - dy, w.yMin, w.yMax) || outside(x, w.xMin, w.xMax);
+
+        if (hitX) dx = -dx;
+        if (hitY) dy = -dy;
+
+        s.vx[i] = dx;
+        s.vy[i] = dy;
+        s.px[i] = x + dx;
+        s.py[i] = y + dy;
+
+        if (hitX || hitY)
+        {
+            hits[numHits].index = (int)i;
+            hits[numHits].axes = (hitX ? HitAxis_X : 0) | (hitY ? HitAxis_Y : 0);
+            numHits++;
+        }
+
+        if (outside(s.px[i], wp.xMin, wp.xMax) || outside(s.py[i], wp.yMin, wp.yMax))
+        {
+            warps[numWarps++] = (int)i;
+        }
+    }
+
+    return numHits;
+}
+
+#if BOUND_USE_AVX || BOUND_USE_SSE
+// lanes個ぶんのマスクからhits/warpsを詰める
+static inline void compact(int base, int hitXBits, int hitYBits, int warpBits, int lanes,
+                           BallHit *hits, int &numHits, int *warps, int &numWarps)
+{
+    int hitBits = hitXBits | hitYBits;
+
+    for (int lane = 0; hitBits != 0 && lane < lanes; lane++, hitBits >>= 1)
+    {
+        if ((hitBits & 1) == 0) continue;
+
+        hits[numHits].index = base + lane;
+        hits[numHits].axes = (((hitXBits >> lane) & 1) ? HitAxis_X : 0) | (((hitYBits >> lane) & 1) ? HitAxis_Y : 0);
+        numHits++;
+    }
+
+    for (int lane = 0; warpBits != 0 && lane < lanes; lane++, warpBits >>= 1)
+    {
+        if (warpBits & 1) warps[numWarps++] = base + lane;
+    }
+}
+#endif
+
+int game::stepBalls(BallStore &s, const WallBounds &w, const WallBounds &wp,
+                    BallHit *hits, int *warps, int &numWarps)
+{
+    return stepBalls(s, 0, s.size(), w, wp, hits, warps, numWarps);
+}
+
+int game::stepBalls(BallStore &s, size_t begin, size_t end, const WallBounds &w, const WallBounds &wp,
+                    BallHit *hits, int *warps, int &numWarps)
+{
+    const size_t n = end;
+    size_t i = begin;
+    int numHits = 0;
+    numWarps = 0;
+
+    float *px = s.px.data();
+    float *py = s.py.data();
+    float *vx = s.vx.data();
+    float *vy = s.vy.data();
+
+#if BOUND_USE_AVX
+    const __m256 xMin = _mm256_set1_ps(w.xMin), xMax = _mm256_set1_ps(w.xMax);
+    const __m256 yMin = _mm256_set1_ps(w.yMin), yMax = _mm256_set1_ps(w.yMax);
+    const __m256 wxMin = _mm256_set1_ps(wp.xMin), wxMax = _mm256_set1_ps(wp.xMax);
+    const __m256 wyMin = _mm256_set1_ps(wp.yMin), wyMax = _mm256_set1_ps(wp.yMax);
+    const __m256 sign = _mm256_set1_ps(-0.f);
+
+    #define BOUND_OUTSIDE(v, lo, hi) _mm256_or_ps(_mm256_cmp_ps(v, lo, _CMP_LT_OQ), _mm256_cmp_ps(v, hi, _CMP_GT_OQ))
+
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i);
+        __m256 dx = _mm256_loadu_ps(vx + i), dy = _mm256_loadu_ps(vy + i);
+
+        const __m256 outX = BOUND_OUTSIDE(x, xMin, xMax);
+        const __m256 outY = BOUND_OUTSIDE(y, yMin, yMax);
+        const __m256 hitX = _mm256_or_ps(_mm256_or_ps(BOUND_OUTSIDE(_mm256_add_ps(x, dx), xMin, xMax),
+                                                      BOUND_OUTSIDE(_mm256_sub_ps(x, dx), xMin, xMax)), outY);
+        const __m256 hitY = _mm256_or_ps(_mm256_or_ps(BOUND_OUTSIDE(_mm256_add_ps(y, dy), yMin, yMax),
+                                                      BOUND_OUTSIDE(_mm256_sub_ps(y, dy), yMin, yMax)), outX);
+
+        dx = _mm256_xor_ps(dx, _mm256_and_ps(hitX, sign));
+        dy = _mm256_xor_ps(dy, _mm256_and_ps(hitY, sign));
+
+        const __m256 nx = _mm256_add_ps(x, dx), ny = _mm256_add_ps(y, dy);
+        _mm256_storeu_ps(vx + i, dx);
+        _mm256_storeu_ps(vy + i, dy);
+        _mm256_storeu_ps(px + i, nx);
+        _mm256_storeu_ps(py + i, ny);
+
+        const __m256 warp = _mm256_or_ps(BOUND_OUTSIDE(nx, wxMin, wxMax), BOUND_OUTSIDE(ny, wyMin, wyMax));
+
+        const int hitXBits = _mm256_movemask_ps(hitX);
+        const int hitYBits = _mm256_movemask_ps(hitY);
+        const int warpBits = _mm256_movemask_ps(warp);
+
+        if ((hitXBits | hitYBits | warpBits) != 0)
+            compact((int)i, hitXBits, hitYBits, warpBits, 8, hits, numHits, warps, numWarps);
+    }
+
+    #undef BOUND_OUTSIDE
+#elif BOUND_USE_SSE
+    const __m128 xMin = _mm_set1_ps(w.xMin), xMax = _mm_set1_ps(w.xMax);
+    const __m128 yMin = _mm_set1_ps(w.yMin), yMax = _mm_set1_ps(w.yMax);
+    const __m128 wxMin = _mm_set1_ps(wp.xMin), wxMax = _mm_set1_ps(wp.xMax);
+    const __m128 wyMin = _mm_set1_ps(wp.yMin), wyMax = _mm_set1_ps(wp.yMax);
+    const __m128 sign = _mm_set1_ps(-0.f);
+
+    #define BOUND_OUTSIDE(v, lo, hi) _mm_or_ps(_mm_cmplt_ps(v, lo), _mm_cmpgt_ps(v, hi))
+
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(px + i), y = _mm_loadu_ps(py + i);
+        __m128 dx = _mm_loadu_ps(vx + i), dy = _mm_loadu_ps(vy + i);
+
+        const __m128 outX = BOUND_OUTSIDE(x, xMin, xMax);
+        const __m128 outY = BOUND_OUTSIDE(y, yMin, yMax);
+        const __m128 hitX = _mm_or_ps(_mm_or_ps(BOUND_OUTSIDE(_mm_add_ps(x, dx), xMin, xMax),
+                                                BOUND_OUTSIDE(_mm_sub_ps(x, dx), xMin, xMax)), outY);
+        const __m128 hitY = _mm_or_ps(_mm_or_ps(BOUND_OUTSIDE(_mm_add_ps(y, dy), yMin, yMax),
+                                                BOUND_OUTSIDE(_mm_sub_ps(y, dy), yMin, yMax)), outX);
+
+        dx = _mm_xor_ps(dx, _mm_and_ps(hitX, sign));
+        dy = _mm_xor_ps(dy, _mm_and_ps(hitY, sign));
+
+        const __m128 nx = _mm_add_ps(x, dx), ny = _mm_add_ps(y, dy);
+        _mm_storeu_ps(vx + i, dx);
+        _mm_storeu_ps(vy + i, dy);
+        _mm_storeu_ps(px + i, nx);
+        _mm_storeu_ps(py + i, ny);
+
+        const __m128 warp = _mm_or_ps(BOUND_OUTSIDE(nx, wxMin, wxMax), BOUND_OUTSIDE(ny, wyMin, wyMax));
+
+        const int hitXBits = _mm_movemask_ps(hitX);
+        const int hitYBits = _mm_movemask_ps(hitY);
+        const int warpBits = _mm_movemask_ps(warp);
+
+        if ((hitXBits | hitYBits | warpBits) != 0)
+            compact((int)i, hitXBits, hitYBits, warpBits, 4, hits, numHits, warps, numWarps);
+    }
+
+    #undef BOUND_OUTSIDE
+#endif
+
+    return stepBallsScalar(s, i, n, w, wp, hits, numHits, warps, numWarps);
+}
@@ -0,0 +1,121 @@
+//
+//  BallStore.h
+//  Bound - App
+//
+//  ボールをStructure of Arraysで持つ。
+//  毎ターン触る位置・速度と、たまにしか見ない色やnoteNumを別の配列に分けている。
+//
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef NAMESPACE_GAME_BEGIN
+ #define NAMESPACE_GAME_BEGIN namespace game {
+ #define NAMESPACE_GAME_END   }
+#endif
+
+NAMESPACE_GAME_BEGIN
+
+struct Ball;
+
+// 壁の位置。壁がない方向は±無限大にしておくので、比較だけで判定できる
+struct WallBounds
+{
+    float xMin, xMax;
+    float yMin, yMax;
+};
+
+enum HitAxis
+{
+    HitAxis_X = 1 << 0,
+    HitAxis_Y = 1 << 1,
+};
+
+struct BallHit
+{
+    int index; // BallStore内の添字
+    int axes;  // HitAxisの組み合わせ
+};
+
+// ボールを指すハンドル。消したボールのハンドルはgenerationが合わなくなるので無効になる
+struct BallHandle
+{
+    uint32_t index;
+    uint32_t generation;
+
+    bool operator== (const BallHandle &other) const { return index == other.index && generation == other.generation; }
+    bool operator!= (const BallHandle &other) const { return !(*this == other); }
+
+    static BallHandle invalid() { BallHandle h; h.index = 0xffffffff; h.generation = 0; return h; }
+};
+
+// 配列は常に詰めて持ち、ハンドルからはslotsを経由して添字を引く(slot map)
+class BallStore
+{
+public:
+    size_t size() const { return px.size(); }
+    bool empty() const  { return px.empty(); }
+    bool full() const   { return capacity > 0 && size() >= capacity; }
+
+    void reserve(size_t n);
+    void setCapacity(size_t n); // 0なら上限なし。それ以外ならn個ぶん先に確保して、それ以上は入れない
+    size_t getCapacity() const { return capacity; }
+
+    BallHandle push(const Ball &ball); // fullならBallHandle::invalid()
+    Ball get(size_t i) const;
+    void set(size_t i, const Ball &ball);
+    void erase(size_t i);             // 最後のボールを空いたところに移す。順番は変わる
+    void eraseIf(const char *remove); // removeが立っている添字をまとめて消す
+    void clear();
+
+    bool contains(BallHandle h) const { return indexOf(h) >= 0; }
+    int indexOf(BallHandle h) const; // 詰めた配列での添字。無効なハンドルなら-1
+    BallHandle getHandle(size_t i) const;
+    bool remove(BallHandle h);
+
+    // hot
+    std::vector<float> px, py;
+    std::vector<float> vx, vy;
+
+    // cold
+    std::vector<float> r, g, b;
+    std::vector<int> lifespan;
+    std::vector<int> id;
+    std::vector<int> noteNum;
+
+private:
+    struct Slot
+    {
+        uint32_t index;      // 使用中なら詰めた配列での添字、空きなら次の空きslot
+        uint32_t generation; // 奇数なら使用中
+    };
+
+    void moveBall(size_t from, size_t to);
+    void popBack();
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> slotOf; // 詰めた配列の添字 -> slot
+    uint32_t freeSlot = 0xffffffff;
+    size_t capacity = 0;
+};
+
+// 全ボールを1ターン進める。壁で反射したボールをhitsに、ワープゾーンに入ったボールをwarpsに詰める。
+// hitsとwarpsはstore.size()個以上の領域を用意しておくこと。
+// 戻り値はhitsに書いた数。warpsに書いた数はnumWarpsに入る。
+int stepBalls(BallStore &store, const WallBounds &walls, const WallBounds &warpBounds,
+              BallHit *hits, int *warps, int &numWarps);
+
+// [begin, end)のボールだけ進める。範囲が重ならなければ別々のスレッドから呼んでいい。
+// hitsとwarpsはend - begin個以上。添字はstore全体でのもの
+int stepBalls(BallStore &store, size_t begin, size_t end, const WallBounds &walls, const WallBounds &warpBounds,
+              BallHit *hits, int *warps, int &numWarps);
+
+// SIMDを使わない版。比較用と端数の処理用
+int stepBallsScalar(BallStore &store, size_t begin, size_t end,
+                    const WallBounds &walls, const WallBounds &warpBounds,
+                    BallHit *hits, int numHits, int *warps, int &numWarps);
+
+NAMESPACE_GAME_END
@@ -0,0 +1,186 @@
+//
+//  BallTrailProgram.cpp
+//  Bound - App
+//
+
+#include "BallTrailProgram.h"
+
+using namespace game;
+
+BallTrailProgram::BallTrailProgram (Block& b) : Program (b)
+{
+    for (int i = 0; i < slotStride; i++)
+        slotData[i] = 0;
+}
+
+void BallTrailProgram::writeSlot (int slot)
+{
+    block.setDataBytes ((size_t) (slot * slotStride), slotData, (size_t) slotStride);
+}
+
+static inline uint8 toByte (float c)
+{
+    return (uint8) (c < 0.f ? 0 : (c > 255.f ? 255 : (int) c));
+}
+
+void BallTrailProgram::setFrame (const BoardFrame& frame)
+{
+    int n = 0;
+
+    for (int x = 0; x < BLOCKS_SIZE && n < MAX_DEVICE_BALLS; x++)
+    {
+        for (int y = 0; y < BLOCKS_SIZE && n < MAX_DEVICE_BALLS; y++)
+        {
+            const BoardState& state = frame[x][y];
+            if (state.c != Charactor_Ball) continue;
+
+            uint8* ball = slotData + n * ballStride;
+            ball[0] = (uint8) (x * BLOCKS_SIZE + y);
+            ball[1] = toByte (state.r);
+            ball[2] = toByte (state.g);
+            ball[3] = toByte (state.b);
+            n++;
+        }
+    }
+
+    numBallsSent = n;
+
+    // 残りは空き。デバイスは最初の空きで読むのをやめる
+    for (; n < MAX_DEVICE_BALLS; n++)
+        slotData[n * ballStride] = 0xff;
+
+    // ボールとフレーム番号を同じ書き込みで送る。フレーム番号が変わったときにはボールはもう届いている
+    slotData[tagOffset] = ++frameNumber;
+    writeSlot (frameNumber % TRAIL_HISTORY);
+}
+
+void BallTrailProgram::clear()
+{
+    // 全部のスロットを空にする。フレーム番号はそのまま
+    for (int n = 0; n < MAX_DEVICE_BALLS; n++)
+        slotData[n * ballStride] = 0xff;
+
+    for (int slot = 0; slot < TRAIL_HISTORY; slot++)
+    {
+        slotData[tagOffset] = (uint8) (frameNumber - ((frameNumber - slot) & (TRAIL_HISTORY - 1)));
+        writeSlot (slot);
+    }
+}
+
+juce::String BallTrailProgram::getLittleFootProgram()
+{
+    String program (R"littlefoot(
+
+    #heapsize: HEAP_SIZE
+
+    void splat (int x, int y, int r, int g, int b)
+    {
+        if (x >= 0 && x < SIZE && y >= 0 && y < SIZE)
+            fillPixel (makeARGB (255, r, g, b), x, y);
+    }
+
+    // Balls next to a wall bleed into it, same as LEDFrameBuffer on the host
+    void bleed (int x, int y, int r, int g, int b)
+    {
+        if (x <= 1)
+        {
+            splat (x - 1, y, r, g, b);
+            splat (x - 1, y + 1, r, g, b);
+            splat (x - 1, y - 1, r, g, b);
+        }
+        if (x >= SIZE - 2)
+        {
+            splat (x + 1, y, r, g, b);
+            splat (x + 1, y + 1, r, g, b);
+            splat (x + 1, y - 1, r, g, b);
+        }
+        if (y <= 1)
+        {
+            splat (x, y - 1, r, g, b);
+            splat (x + 1, y - 1, r, g, b);
+            splat (x - 1, y - 1, r, g, b);
+        }
+        if (y >= SIZE - 2)
+        {
+            splat (x, y + 1, r, g, b);
+            splat (x + 1, y + 1, r, g, b);
+            splat (x - 1, y + 1, r, g, b);
+        }
+    }
+
+    // Draws one frame's balls, dimmed by scale / 256
+    void drawSlot (int slot, int scale)
+    {
+        // Bleed first so the ball cells win
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int n = 0; n < MAX_BALLS; ++n)
+            {
+                int ball = slot * SLOT_STRIDE + n * BALL_STRIDE;
+                int cell = getHeapByte (ball);
+
+                if (cell >= NUM_PIXELS)
+                    break;
+
+                int x = cell / SIZE;
+                int y = cell - x * SIZE;
+                int r = (getHeapByte (ball + 1) * scale) >> 8;
+                int g = (getHeapByte (ball + 2) * scale) >> 8;
+                int b = (getHeapByte (ball + 3) * scale) >> 8;
+
+                if (pass == 0)
+                    bleed (x, y, r, g, b);
+                else
+                    splat (x, y, r, g, b);
+            }
+        }
+    }
+
+    void repaint()
+    {
+        // The newest frame is the tag furthest ahead of slot 0's
+        int first = getHeapByte (TAG_OFFSET);
+        int newest = 0;
+
+        for (int s = 1; s < HISTORY; ++s)
+        {
+            int ahead = (getHeapByte (s * SLOT_STRIDE + TAG_OFFSET) - first) & 255;
+
+            if (ahead < 128 && ahead > newest)
+                newest = ahead;
+        }
+
+        int now = (first + newest) & 255;
+
+        clearDisplay();
+
+        // Oldest first, so newer frames draw over the decayed ones
+        for (int age = HISTORY - 1; age >= 0; --age)
+        {
+            int frame = (now - age) & 255;
+            int slot = frame & (HISTORY - 1);
+
+            if (getHeapByte (slot * SLOT_STRIDE + TAG_OFFSET) == frame)
+            {
+                int scale = 256;
+
+                for (int k = 0; k < age; ++k)
+                    scale = (scale * DECAY) >> 8;
+
+                drawSlot (slot, scale);
+            }
+        }
+    }
+
+    )littlefoot");
+
+    return program.replace ("HEAP_SIZE",     String ((int) heapSize))
+                  .replace ("NUM_PIXELS",    String (BLOCKS_SIZE * BLOCKS_SIZE))
+                  .replace ("SLOT_STRIDE",   String ((int) slotStride))
+                  .replace ("TAG_OFFSET",    String ((int) tagOffset))
+                  .replace ("BALL_STRIDE",   String ((int) ballStride))
+                  .replace ("MAX_BALLS",     String (MAX_DEVICE_BALLS))
+                  .replace ("HISTORY",       String (TRAIL_HISTORY))
+                  .replace ("DECAY",         String ((int) (LEDDECAY * 256)))
+                  .replace ("SIZE",          String (BLOCKS_SIZE));
+}
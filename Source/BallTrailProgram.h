@@ -0,0 +1,54 @@
+//
+//  BallTrailProgram.h
+//  Bound - App
+//
+//  残像の減衰と描画をLightpadの上でやるBlock::Program。
+//  ホストからはボールのいるマスと色、フレーム番号だけをヒープに書く。
+//  BitmapLEDProgramだと毎フレーム残像のマスを全部送ることになるが、これならボールの数ぶんで済む。
+//  ヒープはホストが同期しなおすと全部ホストの値で上書きされるので、デバイスは何も書かない。
+//  かわりに直近TRAIL_HISTORYフレームぶんのボールをリングで持っておき、デバイスは古い順に減衰させて描く。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+
+#define MAX_DEVICE_BALLS 32 // 1フレームで送れるボールのマスの数。これより多いぶんは描かない
+#define TRAIL_HISTORY 16    // 残像に使うフレームの数(2の累乗)。LEDDECAYで16フレーム減衰するとほぼ0になる
+
+class BallTrailProgram : public Block::Program
+{
+public:
+    BallTrailProgram (Block&);
+
+    /** frameのボールのマスを送ってフレームを1つ進める。デバイスはこれを見て減衰させる */
+    void setFrame (const game::BoardFrame& frame);
+
+    /** デバイスの残像を消す */
+    void clear();
+
+    /** 前のsetFrameで送ったボールのマスの数 */
+    int getNumBallsSent() const  { return numBallsSent; }
+
+    juce::String getLittleFootProgram() override;
+
+private:
+    // ヒープの並び。フレーム番号 % TRAIL_HISTORY番目のスロットにそのフレームを書く
+    enum
+    {
+        ballStride  = 4,                                    // ボールごとに マス(x * BLOCKS_SIZE + y、空きは0xff), r, g, b
+        tagOffset   = MAX_DEVICE_BALLS * ballStride,        // スロットの最後はフレーム番号。ボールより先に届かないよう一番うしろに置く
+        slotStride  = tagOffset + 1,
+        heapSize    = slotStride * TRAIL_HISTORY
+    };
+
+    /** スロットをまとめて1回で書く。変わっていないバイトは送られない */
+    void writeSlot (int slot);
+
+    uint8 slotData[slotStride];
+    uint8 frameNumber = 0;
+    int numBallsSent = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BallTrailProgram)
+};
@@ -0,0 +1,317 @@
+//
+//  BlockLayout.cpp
+//  Bound - App
+//
+
+#include "BlockLayout.h"
+
+using namespace game;
+
+namespace
+{
+    // 辺を時計回りに北、東、南、西の順で数える。回すときは足すだけ
+    int toClockwise (Block::ConnectionPort::DeviceEdge edge)
+    {
+        switch (edge)
+        {
+            case Block::ConnectionPort::DeviceEdge::north: return 0;
+            case Block::ConnectionPort::DeviceEdge::east:  return 1;
+            case Block::ConnectionPort::DeviceEdge::south: return 2;
+            case Block::ConnectionPort::DeviceEdge::west:  return 3;
+        }
+
+        return 0;
+    }
+
+    Direction toDirection (int clockwise)
+    {
+        static const Direction directions[] = { Direction_Top, Direction_Right, Direction_Bottom, Direction_Left };
+        return directions[clockwise & 3];
+    }
+
+    Direction opposite (Direction d)
+    {
+        switch (d)
+        {
+            case Direction_Top:    return Direction_Bottom;
+            case Direction_Bottom: return Direction_Top;
+            case Direction_Left:   return Direction_Right;
+            default:               return Direction_Left;
+        }
+    }
+
+    // ブロックを置く座標。Block::getWidthと同じ単位
+    struct Position
+    {
+        float x, y;
+
+        Position operator+ (Position other) const  { return { x + other.x, y + other.y }; }
+        Position operator- (Position other) const  { return { x - other.x, y - other.y }; }
+    };
+
+    // 時計回りに90度 x rotation。y軸は下向き
+    Position rotate (Position p, int rotation)
+    {
+        for (int i = 0; i < (rotation & 3); i++)
+            p = { -p.y, p.x };
+
+        return p;
+    }
+
+    // ポートの真ん中。ブロックの左上が原点。辺の上の番号は北と南なら西から、東と西なら北から数える
+    Position getPortPosition (const BlockLayout::Node& node, const Block::ConnectionPort& port)
+    {
+        const float along = (float) port.index + 0.5f;
+
+        switch (toClockwise (port.edge))
+        {
+            case 0:  return { along, 0.0f };
+            case 1:  return { (float) node.width, along };
+            case 2:  return { along, (float) node.height };
+            default: return { 0.0f, along };
+        }
+    }
+
+    struct Placed
+    {
+        bool placed = false;
+        int rotation = 0;
+        Position origin = { 0.0f, 0.0f }; // ブロックの左上が来るところ
+    };
+}
+
+void BlockLayout::update (const BlockTopology& topology)
+{
+    Array<Node> nodes;
+
+    for (auto b : topology.blocks)
+    {
+        Node n;
+        n.uid = b->uid;
+        n.isLightpad = b->getType() == Block::Type::lightPadBlock;
+        n.width = jmax (1, b->getWidth());
+        n.height = jmax (1, b->getHeight());
+        nodes.add (n);
+    }
+
+    update (nodes, topology.connections);
+}
+
+void BlockLayout::update (const Array<Node>& unsortedNodes, const Array<BlockDeviceConnection>& connections)
+{
+    // UIDの順にたどる。見つかった順に関係なく同じレイアウトになる
+    Array<Node> nodes (unsortedNodes);
+    std::sort (nodes.begin(), nodes.end(), [] (const Node& a, const Node& b) { return a.uid < b.uid; });
+
+    auto indexOf = [&nodes] (Block::UID uid)
+    {
+        for (int i = 0; i < nodes.size(); i++)
+            if (nodes.getReference (i).uid == uid)
+                return i;
+
+        return -1;
+    };
+
+    // Lightpad 1枚ぶんの大きさを格子の1マスにする
+    float tileSize = 2.0f;
+    for (auto& n : nodes)
+    {
+        if (n.isLightpad)
+        {
+            tileSize = (float) n.width;
+            break;
+        }
+    }
+
+    Array<Placed> placed;
+    placed.resize (nodes.size());
+
+    // 1. つながりをたどって置く。前のレイアウトにいたLightpadがあれば、そこから前の向きのまま置きはじめる
+    for (;;)
+    {
+        int root = -1;
+
+        for (int i = 0; i < nodes.size() && root < 0; i++)
+            if (! placed[i].placed && find (nodes.getReference (i).uid) != nullptr)
+                root = i;
+
+        for (int i = 0; i < nodes.size() && root < 0; i++)
+            if (! placed[i].placed && nodes.getReference (i).isLightpad)
+                root = i;
+
+        if (root < 0)
+            break;
+
+        if (auto* previous = find (nodes.getReference (root).uid))
+            placed.getReference (root).rotation = previous->rotation;
+
+        placed.getReference (root).placed = true;
+
+        // 置けなくなるまで、置いたブロックから出ているつながりを順に見る
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+
+            for (auto& c : connections)
+            {
+                const int i1 = indexOf (c.device1), i2 = indexOf (c.device2);
+                if (i1 < 0 || i2 < 0 || placed[i1].placed == placed[i2].placed)
+                    continue;
+
+                const bool fromFirst = placed[i1].placed;
+                const int from = fromFirst ? i1 : i2, to = fromFirst ? i2 : i1;
+                const auto& fromPort = fromFirst ? c.connectionPortOnDevice1 : c.connectionPortOnDevice2;
+                const auto& toPort   = fromFirst ? c.connectionPortOnDevice2 : c.connectionPortOnDevice1;
+
+                const Placed& a = placed[from];
+                Placed& b = placed.getReference (to);
+
+                // 向かい合う辺が反対を向くように回す
+                const int facing = (toClockwise (fromPort.edge) + a.rotation) & 3;
+                b.rotation = (facing + 2 - toClockwise (toPort.edge) + 4) & 3;
+
+                // ポート同士が重なるように置く
+                const auto portPosition = a.origin + rotate (getPortPosition (nodes.getReference (from), fromPort), a.rotation);
+                b.origin = portPosition - rotate (getPortPosition (nodes.getReference (to), toPort), b.rotation);
+                b.placed = true;
+                changed = true;
+            }
+        }
+    }
+
+    // 2. Lightpadを格子に置く
+    Array<Placement> newPlacements;
+    Array<GridPoint> cells;
+
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        const Node& n = nodes.getReference (i);
+        if (! n.isLightpad || ! placed[i].placed)
+            continue;
+
+        const auto centre = placed[i].origin + rotate ({ n.width * 0.5f, n.height * 0.5f }, placed[i].rotation);
+
+        Placement p;
+        p.uid = n.uid;
+        p.island = -1;
+        p.column = p.row = 0;
+        p.rotation = placed[i].rotation;
+
+        for (int d = 0; d < Direction_Num; d++)
+            p.neighbours[d] = 0;
+
+        newPlacements.add (p);
+        cells.add ({ (int) std::floor (centre.x / tileSize), (int) std::floor (centre.y / tileSize) });
+    }
+
+    auto placementOf = [&newPlacements] (Block::UID uid)
+    {
+        for (int i = 0; i < newPlacements.size(); i++)
+            if (newPlacements.getReference (i).uid == uid)
+                return i;
+
+        return -1;
+    };
+
+    // 3. 直接つながっていて、となりのマスにいるLightpad同士をとなりにする。同じ辺を取り合ったら先に見たほう
+    for (auto& c : connections)
+    {
+        const int p1 = placementOf (c.device1), p2 = placementOf (c.device2);
+        if (p1 < 0 || p2 < 0)
+            continue;
+
+        const int dx = cells[p2].x - cells[p1].x, dy = cells[p2].y - cells[p1].y;
+        Direction d;
+
+        if      (dx == 0 && dy == -1) d = Direction_Top;
+        else if (dx == 0 && dy == 1)  d = Direction_Bottom;
+        else if (dx == -1 && dy == 0) d = Direction_Left;
+        else if (dx == 1 && dy == 0)  d = Direction_Right;
+        else continue; // 半分ずれているか、重なっている
+
+        auto& a = newPlacements.getReference (p1);
+        auto& b = newPlacements.getReference (p2);
+
+        if (a.neighbours[d] == 0 && b.neighbours[opposite (d)] == 0)
+        {
+            a.neighbours[d] = b.uid;
+            b.neighbours[opposite (d)] = a.uid;
+        }
+    }
+
+    // 4. となり同士でまとまりを作り、まとまりごとに左上を(0, 0)にする
+    Array<GridPoint> newIslandSizes;
+
+    for (int i = 0; i < newPlacements.size(); i++)
+    {
+        if (newPlacements.getReference (i).island >= 0)
+            continue;
+
+        const int island = newIslandSizes.size();
+        Array<int> members;
+        members.add (i);
+        newPlacements.getReference (i).island = island;
+
+        for (int m = 0; m < members.size(); m++)
+        {
+            for (auto neighbour : newPlacements.getReference (members[m]).neighbours)
+            {
+                const int j = neighbour != 0 ? placementOf (neighbour) : -1;
+
+                if (j >= 0 && newPlacements.getReference (j).island < 0)
+                {
+                    newPlacements.getReference (j).island = island;
+                    members.add (j);
+                }
+            }
+        }
+
+        GridPoint topLeft = cells[i], bottomRight = cells[i];
+        for (auto m : members)
+        {
+            topLeft = { jmin (topLeft.x, cells[m].x), jmin (topLeft.y, cells[m].y) };
+            bottomRight = { jmax (bottomRight.x, cells[m].x), jmax (bottomRight.y, cells[m].y) };
+        }
+
+        for (auto m : members)
+        {
+            newPlacements.getReference (m).column = cells[m].x - topLeft.x;
+            newPlacements.getReference (m).row = cells[m].y - topLeft.y;
+        }
+
+        newIslandSizes.add ({ bottomRight.x - topLeft.x + 1, bottomRight.y - topLeft.y + 1 });
+    }
+
+    placements.swapWith (newPlacements);
+    islandSizes.swapWith (newIslandSizes);
+}
+
+const BlockLayout::Placement* BlockLayout::find (Block::UID uid) const
+{
+    for (auto& p : placements)
+        if (p.uid == uid)
+            return &p;
+
+    return nullptr;
+}
+
+void BlockLayout::blockToBoard (int rotation, int x, int y, int& boardX, int& boardY)
+{
+    // 90度回すと縦横が入れ替わるので、正方形の盤面でしか回せない
+    static_assert (Board::width == Board::height, "quarter turns need a square board");
+
+    const int lastX = Board::width - 1, lastY = Board::height - 1;
+
+    switch (rotation & 3)
+    {
+        case 0:  boardX = x;         boardY = y;         break;
+        case 1:  boardX = lastX - y; boardY = x;         break;
+        case 2:  boardX = lastX - x; boardY = lastY - y; break;
+        default: boardX = y;         boardY = lastY - x; break;
+    }
+}
+
+void BlockLayout::boardToBlock (int rotation, int x, int y, int& blockX, int& blockY)
+{
+    blockToBoard ((4 - (rotation & 3)) & 3, x, y, blockX, blockY);
+}
@@ -0,0 +1,66 @@
+//
+//  BlockLayout.h
+//  Bound - App
+//
+//  BlockTopologyのつながりから、Lightpadの並びと向きを出す。
+//  ブロックの位置はどこにも書いていないので、つながっているポート同士が重なるように、つながりをたどって置いていく。
+//  Lightpad 1枚を1マスとした格子に並べ、ポートで直接つながっていてとなりのマスにいるものを、となりのボードにする。
+//  向きは最初に置いたブロックが基準。前のレイアウトにいたブロックから置きはじめるので、
+//  ブロックを足したり抜いたりしても、残っているブロックの向きは変わらない。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+
+#define MAX_LAYOUT_BOARDS 16 // MainComponentが用意するボードの数。これより多いLightpadはつないでも使わない
+
+class BlockLayout
+{
+public:
+    /** 置くもの。BlockTopologyのブロックから作る。Lightpad以外のブロックもたどるのに使う */
+    struct Node
+    {
+        Block::UID uid;
+        bool isLightpad;
+        int width, height; // Block::getWidth、getHeightと同じ単位
+    };
+    
+    /** 格子の位置や大きさ。Lightpad 1枚が1マス */
+    struct GridPoint
+    {
+        int x, y;
+    };
+    
+    struct Placement
+    {
+        Block::UID uid;
+        int island;      // ポートで直接つながっているLightpadのまとまり。番号は一番小さいUIDの順
+        int column, row; // まとまりの中での格子の位置。左上が(0, 0)
+        int rotation;    // ブロックの上が盤面のどちらを向いているか。時計回りに90度ずつ(0 - 3)
+        Block::UID neighbours[game::Direction_Num]; // 盤面の向きでのとなりのLightpad。いなければ0
+    };
+    
+    BlockLayout() {}
+    
+    /** topologyのLightpadを並べ直す */
+    void update (const BlockTopology& topology);
+    void update (const Array<Node>& nodes, const Array<BlockDeviceConnection>& connections);
+    
+    const Array<Placement>& getPlacements() const  { return placements; }
+    const Placement* find (Block::UID uid) const;
+    
+    int getNumIslands() const                 { return islandSizes.size(); }
+    GridPoint getIslandSize (int island) const { return islandSizes[island]; } // 格子のマスの数
+    
+    /** rotationだけ回したブロックのLEDのマスを、盤面のマスにする。boardToBlockはその逆 */
+    static void blockToBoard (int rotation, int x, int y, int& boardX, int& boardY);
+    static void boardToBlock (int rotation, int x, int y, int& blockX, int& blockY);
+
+private:
+    Array<Placement> placements;
+    Array<GridPoint> islandSizes;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BlockLayout)
+};
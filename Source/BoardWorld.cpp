@@ -0,0 +1,517 @@
+//
+//  BoardWorld.cpp
+//  Bound - App
+//
+
+#include "BoardWorld.h"
+#include "SimulationClock.h"
+
+using namespace game;
+
+template <class BoardType>
+BasicBoardWorld<BoardType>::BasicBoardWorld(int c, int r, size_t maxBallsPerBoard)
+    : columns(jmax(1, c)), rows(jmax(1, r))
+{
+    for (int i = 0; i < columns * rows; i++)
+    {
+        BoardType *b = boards.add(new BoardType(maxBallsPerBoard));
+        b->setDeferred(true);
+    }
+    
+    stepTasks.reserve(boards.size() * MAX_MOVE_CHUNKS);
+    chunkedBoards.reserve(boards.size());
+}
+
+template <class BoardType>
+BasicBoardWorld<BoardType>::~BasicBoardWorld()
+{
+}
+
+template <class BoardType>
+BoardType* BasicBoardWorld<BoardType>::getBoard(int column, int row) const
+{
+    if (! isPositiveAndBelow(column, columns) || ! isPositiveAndBelow(row, rows)) return nullptr;
+    return boards[row * columns + column];
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::connectGrid()
+{
+    for (int row = 0; row < rows; row++)
+    {
+        for (int column = 0; column < columns; column++)
+        {
+            BoardType *b = getBoard(column, row);
+            b->connect(getBoard(column - 1, row), Direction_Left);
+            b->connect(getBoard(column + 1, row), Direction_Right);
+            b->connect(getBoard(column, row - 1), Direction_Top);
+            b->connect(getBoard(column, row + 1), Direction_Bottom);
+        }
+    }
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::disconnectAll()
+{
+    for (auto *b : boards)
+    {
+        for (int d = 0; d < Direction_Num; d++)
+        {
+            b->disConnect((Direction) d);
+        }
+    }
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::setScheduler(TaskScheduler *s)
+{
+    scheduler = s;
+    
+    if (s != ownedScheduler.get())
+        ownedScheduler = nullptr;
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::setNumThreads(int n)
+{
+    ownedScheduler = new TaskScheduler(n);
+    scheduler = ownedScheduler.get();
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::setBallCollisions(bool shouldCollide)
+{
+    ballCollisions = shouldCollide;
+    
+    for (auto *b : boards)
+    {
+        b->setBallCollisions(shouldCollide);
+    }
+}
+
+template <class BoardType>
+int BasicBoardWorld<BoardType>::getNumCollisionsLastMove() const
+{
+    int n = 0;
+    for (auto *b : boards)
+    {
+        n += b->getNumCollisionsLastMove();
+    }
+    return n;
+}
+
+template <class BoardType>
+int64 BasicBoardWorld<BoardType>::getNumDroppedNotes() const
+{
+    int64 n = 0;
+    for (auto *b : boards)
+    {
+        n += b->getNumDroppedNotes();
+    }
+    return n;
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::runTasks(TaskScheduler::TaskFunction function, int numTasks)
+{
+    if (scheduler != nullptr)
+    {
+        scheduler->run(function, this, numTasks);
+        return;
+    }
+    
+    for (int i = 0; i < numTasks; i++)
+    {
+        function(this, i);
+    }
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::stepTask(void *context, int index)
+{
+    BasicBoardWorld &world = *static_cast<BasicBoardWorld*>(context);
+    const StepTask &task = world.stepTasks[index];
+    
+    if (task.chunk < 0)
+        task.board->move(world.tickTimeMs, world.tickIntervalMs);
+    else
+        task.board->stepChunk(task.chunk);
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::endMoveTask(void *context, int index)
+{
+    BasicBoardWorld &world = *static_cast<BasicBoardWorld*>(context);
+    world.chunkedBoards[index]->endMove();
+}
+
+template <class BoardType>
+void BasicBoardWorld<BoardType>::move(double timeMs, double intervalMs)
+{
+    tickTimeMs = timeMs;
+    tickIntervalMs = intervalMs;
+    
+    // 1. 並列に進める。ボールの多いボードは範囲に分けて、空いたスレッドに盗ませる
+    stepTasks.clear();
+    chunkedBoards.clear();
+    
+    for (auto *b : boards)
+    {
+        const int numBalls = (int) b->getNumBalls();
+        const int numChunks = jmin(MAX_MOVE_CHUNKS, (numBalls + ballsPerChunk - 1) / ballsPerChunk);
+        
+        if (numChunks > 1 && b->beginMove(timeMs, intervalMs, numChunks))
+        {
+            for (int c = 0; c < numChunks; c++)
+            {
+                stepTasks.push_back({ b, c });
+            }
+            chunkedBoards.push_back(b);
+        }
+        else
+        {
+            stepTasks.push_back({ b, -1 });
+        }
+    }
+    
+    runTasks(stepTask, (int) stepTasks.size());
+    
+    // 分けたボードは、ぶつかったボールの音を作ってとなりへのボールをためる。これもボードごとに並列
+    runTasks(endMoveTask, (int) chunkedBoards.size());
+    
+    // 2. となりに渡す
+    numWarpsLastMove = 0;
+    for (auto *b : boards)
+    {
+        numWarpsLastMove += b->deliverWarps();
+    }
+    
+    // 3. 音を積む
+    numNotesLastMove = 0;
+    for (auto *b : boards)
+    {
+        numNotesLastMove += b->flushNotes();
+    }
+}
+
+template <class BoardType>
+uint64_t BasicBoardWorld<BoardType>::getChecksum() const
+{
+    uint64_t h = 0;
+    for (auto *b : boards)
+    {
+        h = h * 1099511628211ull + b->getChecksum();
+    }
+    return h;
+}
+
+template <class BoardType>
+bool BasicBoardWorld<BoardType>::checkDeterminism(int columns, int rows, int numBalls, int numTicks, int maxThreads)
+{
+    if (maxThreads <= 0) maxThreads = SystemStats::getNumCpus();
+    
+    uint64_t expected = 0;
+    
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        BasicBoardWorld world(columns, rows);
+        world.connectGrid();
+        world.setNumThreads(threads);
+        
+        // 1スレッドのときは分けずに進めて、それを正解にする
+        world.setBallsPerChunk(threads == 1 ? std::numeric_limits<int>::max() : 16);
+        
+        Random random(1234);
+        
+        for (int i = 0; i < numBalls; i++)
+        {
+            BoardType *b = world.getBoard(random.nextInt(world.getNumBoards()));
+            
+            Ball ball;
+            ball.px = random.nextFloat() * (BoardType::width - 1);
+            ball.py = random.nextFloat() * (BoardType::height - 1);
+            ball.vx = random.nextFloat() * 4.f - 2.f;
+            ball.vy = random.nextFloat() * 4.f - 2.f;
+            ball.r = ball.g = ball.b = 255;
+            ball.lifespan = -1;
+            ball.noteNum = i % 16;
+            b->addBall(ball);
+        }
+        
+        for (int t = 0; t < numTicks; t++)
+        {
+            world.move();
+        }
+        
+        const uint64_t checksum = world.getChecksum();
+        
+        if (threads == 1)
+        {
+            expected = checksum;
+        }
+        else if (checksum != expected)
+        {
+            jassertfalse; // スレッドの数で結果が変わった
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+template <class BoardType>
+int64 BasicBoardWorld<BoardType>::checkAllocations(int columns, int rows, int numBalls, int numTicks, int numThreads)
+{
+   #if BOUND_COUNT_ALLOCATIONS
+    int64 numAllocations = 0;
+    
+    for (int collisions = 0; collisions < 2; collisions++)
+    {
+        BasicBoardWorld world(columns, rows, (size_t) jmax(1, numBalls));
+        world.connectGrid();
+        world.setNumThreads(numThreads);
+        world.setBallsPerChunk(jmax(1, numBalls / 4)); // 範囲に分けて進めるところも通す
+        world.setBallCollisions(collisions != 0);
+        
+        // デフォルトの配線で音も鳴らす。シンセはいらないので名前でキャプチャに向ける
+        MidiRouting routing = MidiRouting::createDefault();
+        for (auto &rule : routing.rules)
+        {
+            rule.deviceName = "capture:" + rule.deviceName;
+        }
+        
+        Random random(1234);
+        
+        for (int boardIndex = 0; boardIndex < world.getNumBoards(); boardIndex++)
+        {
+            BoardType *b = world.getBoard(boardIndex);
+            b->setRoutes(routing.compile(boardIndex, MidiOutManager::getSharedInstance()));
+            
+            for (int i = 0; i < numBalls; i++)
+            {
+                Ball ball;
+                ball.px = random.nextFloat() * (BoardType::width - 1);
+                ball.py = random.nextFloat() * (BoardType::height - 1);
+                ball.vx = random.nextFloat() * 4.f - 2.f;
+                ball.vy = random.nextFloat() * 4.f - 2.f;
+                ball.r = ball.g = ball.b = 255;
+                ball.lifespan = -1;
+                ball.noteNum = i % 16;
+                b->addBall(ball);
+            }
+        }
+        
+        const long long start = AllocationCounter::getTotalNumAllocations();
+        
+        for (int t = 0; t < numTicks; t++)
+        {
+            world.move();
+        }
+        
+        numAllocations += AllocationCounter::getTotalNumAllocations() - start;
+    }
+    
+    return numAllocations;
+   #else
+    ignoreUnused(columns, rows, numBalls, numTicks, numThreads);
+    return -1;
+   #endif
+}
+
+template <class BoardType>
+String BasicBoardWorld<BoardType>::benchmarkScaling(int columns, int rows, int numBalls, int numTicks, int maxThreads)
+{
+    if (maxThreads <= 0) maxThreads = SystemStats::getNumCpus();
+    
+    String report;
+    report << "balls " << numBalls << ", boards " << columns << "x" << rows << ", ticks " << numTicks << "\n"
+           << "threads  chunked ms/tick  speedup  per-board ms/tick  speedup\n";
+    
+    double baseline[2] = { 0, 0 };
+    
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        double msPerTick[2];
+        
+        for (int chunked = 1; chunked >= 0; chunked--)
+        {
+            BasicBoardWorld world(columns, rows);
+            world.setNumThreads(threads);
+            world.setBallsPerChunk(chunked ? DEFAULT_BALLS_PER_CHUNK : std::numeric_limits<int>::max());
+            
+            Random random(1234);
+            
+            for (int i = 0; i < numBalls; i++)
+            {
+                // 3/4は最初のボードに集める
+                const int index = (i % 4 != 0 || world.getNumBoards() == 1) ? 0 : 1 + random.nextInt(world.getNumBoards() - 1);
+                
+                Ball ball;
+                ball.px = random.nextFloat() * (BoardType::width - 1);
+                ball.py = random.nextFloat() * (BoardType::height - 1);
+                ball.vx = random.nextFloat() * 0.5f - 0.25f;
+                ball.vy = random.nextFloat() * 0.5f - 0.25f;
+                ball.r = ball.g = ball.b = 255;
+                ball.lifespan = -1;
+                ball.noteNum = i % 16;
+                world.getBoard(index)->addBall(ball);
+            }
+            
+            // 温める
+            for (int t = 0; t < 10; t++)
+            {
+                world.move();
+            }
+            
+            const double start = Time::getMillisecondCounterHiRes();
+            for (int t = 0; t < numTicks; t++)
+            {
+                world.move();
+            }
+            msPerTick[chunked] = (Time::getMillisecondCounterHiRes() - start) / jmax(1, numTicks);
+        }
+        
+        if (threads == 1)
+        {
+            baseline[0] = msPerTick[0];
+            baseline[1] = msPerTick[1];
+        }
+        
+        report << String(threads).paddedLeft(' ', 7)
+               << String(msPerTick[1], 3).paddedLeft(' ', 17)
+               << String(baseline[1] / msPerTick[1], 2).paddedLeft(' ', 9)
+               << String(msPerTick[0], 3).paddedLeft(' ', 19)
+               << String(baseline[0] / msPerTick[0], 2).paddedLeft(' ', 9) << "\n";
+    }
+    
+    return report;
+}
+
+template <class BoardType>
+String BasicBoardWorld<BoardType>::benchmarkCollisions(int numTicks, float radius)
+{
+    const int counts[] = { 10, 100, 1000, 10000, 50000 };
+    const int maxBruteForce = 10000;
+    numTicks = jmax(1, numTicks);
+    
+    // drift: どのボールもゆっくり。flick: Lightpadを端から端まではじいたくらいまで(1ターンに最大7マス)
+    const char *profiles[] = { "drift", "flick" };
+    
+    String report;
+    report << "board " << BoardType::width << "x" << BoardType::height << ", radius " << String(radius, 2) << ", ticks " << numTicks
+           << ", * = over the " << String(DEFAULT_TICK_INTERVAL_MS, 0) << "ms tick\n";
+    
+    for (int profile = 0; profile < 2; profile++)
+    {
+        report << profiles[profile] << "\n"
+               << "  balls  grid ms/tick  pairs/tick  collisions/tick  wide/tick  brute-force ms/tick  pairs/tick  same\n";
+        
+        for (int numBalls : counts)
+        {
+            double msPerTick[2] = { 0, 0 };
+            int64_t pairs[2] = { 0, 0 };
+            int64_t collisions = 0, wide = 0;
+            uint64_t checksum[2] = { 0, 0 };
+            const int numModes = numBalls <= maxBruteForce ? 2 : 1;
+            
+            for (int mode = 0; mode < numModes; mode++)
+            {
+                BallStore store;
+                BallCollider collider;
+                collider.setRadius(radius);
+                collider.setUseGrid(mode == 0);
+                
+                Random random(4321);
+                
+                for (int i = 0; i < numBalls; i++)
+                {
+                    Ball ball;
+                    ball.px = random.nextFloat() * (BoardType::width - 1);
+                    ball.py = random.nextFloat() * (BoardType::height - 1);
+                    
+                    if (profile == 0)
+                    {
+                        ball.vx = random.nextFloat() * 0.5f - 0.25f;
+                        ball.vy = random.nextFloat() * 0.5f - 0.25f;
+                    }
+                    else
+                    {
+                        // launchBallと同じで、ドラッグしたLEDの数の半分
+                        ball.vx = (float) random.nextInt(Range<int>(-(BLOCKS_SIZE - 1), BLOCKS_SIZE)) / 2.f;
+                        ball.vy = (float) random.nextInt(Range<int>(-(BLOCKS_SIZE - 1), BLOCKS_SIZE)) / 2.f;
+                    }
+                    
+                    ball.r = ball.g = ball.b = 255;
+                    ball.lifespan = -1;
+                    ball.id = i;
+                    ball.noteNum = 0;
+                    store.push(ball);
+                }
+                
+                // 四方とも壁。ワープはしない
+                const float inf = std::numeric_limits<float>::infinity();
+                const WallBounds walls = { 0.f, (float) (BoardType::width - 1), 0.f, (float) (BoardType::height - 1) };
+                const WallBounds warpBounds = { -inf, inf, -inf, inf };
+                std::vector<BallHit> hits((size_t) numBalls);
+                std::vector<int> warps((size_t) numBalls);
+                int numWarps;
+                
+                double collideMs = 0;
+                
+                for (int t = 0; t < numTicks; t++)
+                {
+                    const double start = Time::getMillisecondCounterHiRes();
+                    const int n = collider.collide(store);
+                    collideMs += Time::getMillisecondCounterHiRes() - start;
+                    
+                    pairs[mode] += collider.getNumPairsTested();
+                    if (mode == 0)
+                    {
+                        collisions += n;
+                        wide += collider.getNumWideBalls();
+                    }
+                    
+                    stepBalls(store, walls, warpBounds, hits.data(), warps.data(), numWarps);
+                }
+                
+                msPerTick[mode] = collideMs / numTicks;
+                
+                // 位置と速度のFNV-1a
+                uint64_t h = 14695981039346656037ull;
+                for (size_t i = 0; i < store.size(); i++)
+                {
+                    const float values[4] = { store.px[i], store.py[i], store.vx[i], store.vy[i] };
+                    const uint8_t *p = (const uint8_t*) values;
+                    for (size_t k = 0; k < sizeof(values); k++)
+                    {
+                        h = (h ^ p[k]) * 1099511628211ull;
+                    }
+                }
+                checksum[mode] = h;
+            }
+            
+            report << String(numBalls).paddedLeft(' ', 7)
+                   << (String(msPerTick[0], 3) + (msPerTick[0] > DEFAULT_TICK_INTERVAL_MS ? "*" : " ")).paddedLeft(' ', 14)
+                   << String(pairs[0] / numTicks).paddedLeft(' ', 12)
+                   << String((int) (collisions / numTicks)).paddedLeft(' ', 17)
+                   << String((int) (wide / numTicks)).paddedLeft(' ', 11);
+            
+            if (numModes == 2)
+            {
+                report << String(msPerTick[1], 3).paddedLeft(' ', 21)
+                       << String(pairs[1] / numTicks).paddedLeft(' ', 12)
+                       << (checksum[0] == checksum[1] ? "   yes" : "    no") << "\n";
+            }
+            else
+            {
+                report << "                   -           -     -\n";
+            }
+        }
+    }
+    
+    return report;
+}
+
+// 使う大きさだけここで実体化する
+template class game::BasicBoardWorld<Board>;
+template class game::BasicBoardWorld<CanvasBoard>;
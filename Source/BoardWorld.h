@@ -0,0 +1,137 @@
+//
+//  BoardWorld.h
+//  Bound - App
+//
+//  ボードを縦横に並べて持ち、全部まとめて1ターン進める。
+//  1. 全部のボードを並列に進める。ボードはdeferredにしてあるので、となりへのボールと衝突の音はためておくだけ。
+//     TaskSchedulerに配るので、ボールの多いボードは範囲に分けて何スレッドかで進め、そのあとボードごとに音を作る
+//  2. ボードの番号順に、ためたボールをとなりに渡す(辺ごとのキュー)
+//  3. ボードの番号順に、衝突の音をMidiOutManagerに積む
+//  2と3は1つのスレッドで決まった順にやるので、結果はスレッドの数に関係なく同じになる。
+//  ボードの型(大きさ)はテンプレートで選ぶ。BoardWorldはLightpad 1枚ずつ、CanvasBoardWorldは64x64の盤面を並べる。
+//  RenderPipelineに渡してLEDに出せるのはBoardWorldだけ
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "TaskScheduler.h"
+
+#define DEFAULT_BALLS_PER_CHUNK 2048 // これより多いボードは範囲に分けて進める
+
+NAMESPACE_GAME_BEGIN
+
+template <class BoardType>
+class BasicBoardWorld
+{
+public:
+    // columns x rows枚のボードを作る。maxBallsPerBoardはBoardと同じ(0なら上限なし)。
+    // つなぐのはconnectGridか、自分でBoard::connect
+    BasicBoardWorld(int columns, int rows, size_t maxBallsPerBoard = 0);
+    ~BasicBoardWorld();
+    
+    int getNumColumns() const { return columns; }
+    int getNumRows() const    { return rows; }
+    int getNumBoards() const  { return boards.size(); }
+    
+    // 番号はrow * columns + column
+    BoardType* getBoard(int index) const { return boards[index]; }
+    BoardType* getBoard(int column, int row) const;
+    
+    // BoardWorldならRenderPipeline::publishにそのまま渡せる
+    BoardType* const* getBoards() { return boards.getRawDataPointer(); }
+    
+    // 上下左右のとなり同士をつなぐ
+    void connectGrid();
+    void disconnectAll();
+    
+    // 1をやるスケジューラ。RenderPipelineなどほかの段と共有していい。nullptrなら呼んだスレッドだけで進める
+    void setScheduler(TaskScheduler *scheduler);
+    TaskScheduler* getScheduler() const { return scheduler; }
+    
+    // 自分用のスケジューラをnumThreadsで作って使う。呼んだスレッドも1つに数える。0ならCPUの数
+    void setNumThreads(int numThreads);
+    int getNumThreads() const { return scheduler != nullptr ? scheduler->getNumThreads() : 1; }
+    
+    // 1つの範囲に入れるボールの数。これより多いボードはほかのスレッドにも手伝わせる
+    void setBallsPerChunk(int numBalls) { ballsPerChunk = jmax(1, numBalls); }
+    int getBallsPerChunk() const { return ballsPerChunk; }
+    
+    // 全部のボードでボール同士をぶつける(Board::setBallCollisions)
+    void setBallCollisions(bool shouldCollide);
+    bool getBallCollisions() const { return ballCollisions; }
+    
+    // 全部のボードを1ターン進める。ほかのスレッドから同時に呼ばないこと
+    void move(double tickTimeMs, double tickIntervalMs);
+    void move() { move(0, 0); }
+    
+    // 前のmoveで渡したボールと積んだ音の数
+    int getNumWarpsLastMove() const { return numWarpsLastMove; }
+    int getNumNotesLastMove() const { return numNotesLastMove; }
+    int getNumChunksLastMove() const { return (int) stepTasks.size(); }
+    int getNumCollisionsLastMove() const;
+    
+    // 全部のボードのBoard::getNumDroppedNotes
+    int64 getNumDroppedNotes() const;
+    
+    // 全部のボードのBoard::getChecksumをまとめたもの
+    uint64_t getChecksum() const;
+    
+    // columns x rowsの盤面にnumBalls個のボールを置いて、スレッドの数を1からmaxThreadsまで変えて
+    // numTicksターン進め、全部同じ盤面になるか確かめる。2スレッドからは範囲にも細かく分ける。音は出さない。
+    // maxThreadsが0ならCPUの数
+    static bool checkDeterminism(int columns, int rows, int numBalls, int numTicks, int maxThreads);
+    
+    // 固定容量(maxBallsPerBoard = numBalls)のボードをnumThreadsスレッドでnumTicksターン進めて、その間に
+    // 全部のスレッドで起きたヒープ確保の回数を返す。ボール同士の衝突なしとありで1回ずつ。
+    // 配線はデフォルトのものを全部キャプチャに向けて使うので、音をためてplayNoteに積むところも通る(送信スレッドは数えない)。
+    // BOUND_COUNT_ALLOCATIONS=1でビルドしていないと数えられないので-1
+    static int64 checkAllocations(int columns, int rows, int numBalls, int numTicks, int numThreads);
+    
+    // ベンチマーク。最初のボードにnumBallsの3/4を置き、残りをほかのボードに散らして、
+    // スレッドの数を1からmaxThreadsまで変えたときの1ターンあたりの時間を表にして返す。
+    // 範囲に分けたときと、ボード単位でしか分けないときを並べる。偏りが崩れないようにボードはつながない
+    static String benchmarkScaling(int columns, int rows, int numBalls, int numTicks, int maxThreads);
+    
+    // ボール同士の衝突のベンチマーク。BoardTypeと同じ広さに10個から50000個までのボールを置き、
+    // BallCollider::collideの1ターンあたりの時間をグリッドと全部の組を調べたときで並べる。
+    // 速さはゆっくり(drift)と、はじいたくらい(flick、1ターンに最大7マス)の2通り。
+    // 全部の組は10000個まで。両方で同じ盤面になったかも出す。1ターンの時間を超えたものには*をつける
+    static String benchmarkCollisions(int numTicks, float radius = DEFAULT_BALL_RADIUS);
+    
+private:
+    struct StepTask
+    {
+        BoardType *board;
+        int chunk; // -1ならボード全部をmoveする
+    };
+    
+    void runTasks(TaskScheduler::TaskFunction function, int numTasks);
+    static void stepTask(void *world, int index);
+    static void endMoveTask(void *world, int index);
+    
+    const int columns, rows;
+    OwnedArray<BoardType> boards;
+    TaskScheduler *scheduler = nullptr;
+    ScopedPointer<TaskScheduler> ownedScheduler;
+    int ballsPerChunk = DEFAULT_BALLS_PER_CHUNK;
+    bool ballCollisions = false;
+    
+    // moveの間だけ使う
+    double tickTimeMs = 0, tickIntervalMs = 0;
+    std::vector<StepTask> stepTasks;
+    std::vector<BoardType*> chunkedBoards; // 範囲に分けたので、あとでendMoveするボード
+    
+    int numWarpsLastMove = 0, numNotesLastMove = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BasicBoardWorld)
+};
+
+typedef BasicBoardWorld<Board> BoardWorld;
+typedef BasicBoardWorld<CanvasBoard> CanvasBoardWorld;
+
+extern template class BasicBoardWorld<Board>;
+extern template class BasicBoardWorld<CanvasBoard>;
+
+NAMESPACE_GAME_END
@@ -0,0 +1,246 @@
+//
+//  EventEngine.cpp
+//  Bound - App
+//
+
+#include "EventEngine.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+using namespace game;
+
+EventEngine::EventEngine(BallStore &store, int width, int height)
+    : balls(store), lastCell{ width - 1, height - 1 }
+{
+    for (int i = 0; i < 4; i++) wall[i] = true;
+}
+
+void EventEngine::reserve(size_t n)
+{
+    heap.reserve(n * 2);
+    state.reserve(n);
+}
+
+void EventEngine::setWalls(bool left, bool right, bool top, bool bottom)
+{
+    if (wall[0] == left && wall[1] == right && wall[2] == top && wall[3] == bottom) return;
+
+    wall[0] = left;
+    wall[1] = right;
+    wall[2] = top;
+    wall[3] = bottom;
+    scheduleAll();
+}
+
+void EventEngine::schedule(BallHandle handle)
+{
+    schedule(handle, now);
+}
+
+void EventEngine::schedule(BallHandle handle, double time)
+{
+    const int i = balls.indexOf(handle);
+    if (i < 0) return;
+
+    if (handle.index >= state.size())
+    {
+        state.resize(handle.index + 1);
+    }
+
+    SlotState &st = state[handle.index];
+    st.time = time;
+    st.cellX = std::min(std::max((int)std::floor(balls.px[i]), 0), lastCell[0]);
+    st.cellY = std::min(std::max((int)std::floor(balls.py[i]), 0), lastCell[1]);
+    st.version++;
+
+    Entry entry;
+    if (predict(i, st, entry))
+    {
+        push(entry);
+    }
+}
+
+void EventEngine::scheduleAll()
+{
+    syncPositions();
+    heap.clear();
+
+    for (size_t i = 0; i < balls.size(); i++)
+    {
+        schedule(balls.getHandle(i), now);
+    }
+}
+
+void EventEngine::clear()
+{
+    heap.clear();
+}
+
+void EventEngine::syncPositions()
+{
+    for (size_t i = 0; i < balls.size(); i++)
+    {
+        const uint32_t slot = balls.getHandle(i).index;
+        if (slot >= state.size()) continue;
+
+        SlotState &st = state[slot];
+        const float dt = (float)(now - st.time);
+        balls.px[i] += balls.vx[i] * dt;
+        balls.py[i] += balls.vy[i] * dt;
+        st.time = now;
+    }
+}
+
+bool EventEngine::getCell(BallHandle handle, int &x, int &y) const
+{
+    if (!balls.contains(handle) || handle.index >= state.size()) return false;
+
+    x = state[handle.index].cellX;
+    y = state[handle.index].cellY;
+    return true;
+}
+
+// 次にx方向とy方向の境目(マスの境目か壁)に着く時刻のうち早い方
+bool EventEngine::predict(size_t i, const SlotState &st, Entry &entry) const
+{
+    const float p[2] = { balls.px[i], balls.py[i] };
+    const float v[2] = { balls.vx[i], balls.vy[i] };
+    const int cell[2] = { st.cellX, st.cellY };
+
+    double best = -1;
+    int bestAxis = 0;
+
+    for (int a = 0; a < 2; a++)
+    {
+        if (v[a] == 0) continue;
+
+        // 右(下)に進むなら次のマスの左端、左(上)に進むなら今のマスの左端が境目
+        const int boundary = v[a] > 0 ? std::min(cell[a] + 1, lastCell[a]) : cell[a];
+        const double dt = std::max(0.0, (double)(boundary - p[a]) / v[a]);
+
+        if (best < 0 || dt < best)
+        {
+            best = dt;
+            bestAxis = a == 0 ? HitAxis_X : HitAxis_Y;
+        }
+    }
+
+    if (best < 0) return false; // 止まっている
+
+    entry.time = st.time + best;
+    entry.handle = balls.getHandle(i);
+    entry.version = st.version;
+    entry.axis = bestAxis;
+    return true;
+}
+
+void EventEngine::push(const Entry &entry)
+{
+    if (heap.size() == heap.capacity() && heap.capacity() > 0)
+    {
+        purgeStaleEntries();
+    }
+
+    Entry e = entry;
+    e.order = nextOrder++;
+    heap.push_back(e);
+    std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+}
+
+void EventEngine::purgeStaleEntries()
+{
+    size_t out = 0;
+    for (size_t i = 0; i < heap.size(); i++)
+    {
+        const Entry &e = heap[i];
+        if (balls.contains(e.handle) && e.handle.index < state.size() && state[e.handle.index].version == e.version)
+        {
+            heap[out++] = e;
+        }
+    }
+
+    heap.resize(out);
+    std::make_heap(heap.begin(), heap.end(), std::greater<Entry>());
+}
+
+int EventEngine::advance(double dt, Listener &listener)
+{
+    const double target = now + dt;
+    int numEvents = 0;
+
+    while (!heap.empty() && heap.front().time <= target)
+    {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+        const Entry entry = heap.back();
+        heap.pop_back();
+
+        const int i = balls.indexOf(entry.handle);
+        if (i < 0) continue;
+
+        SlotState &st = state[entry.handle.index];
+        if (st.version != entry.version) continue;
+
+        // イベントの時刻まで進める
+        const float t = (float)(entry.time - st.time);
+        balls.px[i] += balls.vx[i] * t;
+        balls.py[i] += balls.vy[i] * t;
+        st.time = entry.time;
+
+        const bool isX = entry.axis == HitAxis_X;
+        float &p = isX ? balls.px[i] : balls.py[i];
+        float &v = isX ? balls.vx[i] : balls.vy[i];
+        int &cell = isX ? st.cellX : st.cellY;
+
+        BallEvent event;
+        event.handle = entry.handle;
+        event.axis = entry.axis;
+        event.time = entry.time;
+        event.fromX = event.toX = st.cellX;
+        event.fromY = event.toY = st.cellY;
+
+        const int edge = lastCell[isX ? 0 : 1];
+        const bool atEdge = v > 0 ? cell == edge : cell == 0;
+        if (atEdge)
+        {
+            p = v > 0 ? (float)edge : 0.f;
+
+            const bool isWall = isX ? wall[v > 0 ? 1 : 0] : wall[v > 0 ? 3 : 2];
+            if (isWall)
+            {
+                v = -v;
+                event.type = BallEvent_Wall;
+            }
+            else
+            {
+                event.type = BallEvent_Exit;
+            }
+        }
+        else
+        {
+            p = (float)(v > 0 ? cell + 1 : cell);
+            cell += v > 0 ? 1 : -1;
+            event.type = BallEvent_Cell;
+            event.toX = st.cellX;
+            event.toY = st.cellY;
+        }
+
+        event.x = balls.px[i];
+        event.y = balls.py[i];
+
+        if (event.type != BallEvent_Exit)
+        {
+            Entry next;
+            if (predict(i, st, next))
+            {
+                push(next);
+            }
+        }
+
+        numEvents++;
+        listener.ballEvent(event);
+    }
+
+    now = target;
+    return numEvents;
+}
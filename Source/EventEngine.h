@@ -0,0 +1,107 @@
+//
+//  EventEngine.h
+//  Bound - App
+//
+//  イベント駆動の物理エンジン。
+//  ボールは等速直線運動で壁は軸に平行なので、次に壁やマスの境目に当たる時刻は計算で出せる。
+//  ボールごとに次のイベントをひとつだけ優先度付きキューに積んでおき、時刻順に取り出して進める。
+//  動いていないボールや広い盤面にまばらにいるボールはほとんどコストがかからない。
+//
+
+#pragma once
+
+#include <vector>
+#include "BallStore.h"
+
+NAMESPACE_GAME_BEGIN
+
+enum BallEventType
+{
+    BallEvent_Wall, // 壁で反射した
+    BallEvent_Exit, // つながっている辺から出ていった(ボールはもう進めない)
+    BallEvent_Cell, // 別のマスに入った
+};
+
+struct BallEvent
+{
+    BallEventType type;
+    BallHandle handle;
+    int axis;        // HitAxis_XかHitAxis_Y
+    double time;     // ターン単位の時刻。小数部分がターン内のどこで起きたか
+    float x, y;      // その時刻での位置
+    int fromX, fromY; // BallEvent_Cellのときの移動元と移動先のマス
+    int toX, toY;
+};
+
+class EventEngine
+{
+public:
+    struct Listener
+    {
+        virtual ~Listener() {}
+
+        /** Called for every event in time order. The ball may be removed from the store inside this callback. */
+        virtual void ballEvent(const BallEvent &event) = 0;
+    };
+
+    // 位置はxが[0, width - 1]、yが[0, height - 1]。storeは同じBoardが持っているもの
+    EventEngine(BallStore &store, int width, int height);
+
+    void reserve(size_t n);
+
+    // 各辺が壁かどうか。falseの辺はBallEvent_Exitになる。変えたら全部のボールを予約しなおす
+    void setWalls(bool left, bool right, bool top, bool bottom);
+
+    double getTime() const { return now; }
+
+    // store.pxなどがtimeの時点での位置になっているボールを予約する。timeを省略したら今
+    void schedule(BallHandle handle);
+    void schedule(BallHandle handle, double time);
+    void scheduleAll();
+    void clear(); // 予約を全部捨てる
+
+    // storeの位置を今の時刻まで進める(描画やモード切り替えの前に)
+    void syncPositions();
+
+    bool getCell(BallHandle handle, int &x, int &y) const;
+
+    // 時刻をdtだけ進め、その間のイベントを時刻順にlistenerへ渡す。処理したイベントの数を返す
+    int advance(double dt, Listener &listener);
+
+private:
+    struct Entry
+    {
+        double time;
+        uint64_t order; // 同じ時刻なら積んだ順
+        BallHandle handle;
+        uint32_t version;
+        int axis;
+
+        bool operator> (const Entry &other) const
+        {
+            return time > other.time || (time == other.time && order > other.order);
+        }
+    };
+
+    struct SlotState
+    {
+        double time; // store.px/pyがどの時刻での位置か
+        int cellX, cellY;
+        uint32_t version; // 予約しなおしたら古いEntryを捨てるため
+    };
+
+    bool predict(size_t index, const SlotState &state, Entry &entry) const;
+    void push(const Entry &entry);
+    void purgeStaleEntries();
+
+    BallStore &balls;
+    const int lastCell[2]; // 軸ごとの端のマス
+    bool wall[4]; // left, right, top, bottom
+    double now = 0;
+    uint64_t nextOrder = 0;
+
+    std::vector<Entry> heap;      // std::push_heap/pop_heapで使う
+    std::vector<SlotState> state; // slotごと
+};
+
+NAMESPACE_GAME_END
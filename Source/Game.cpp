@@ -9,127 +9,585 @@
 
 using namespace game;
 
-int Board::addBall(Ball &b)
+static std::atomic<int> lastId(0);
+
+int game::newBallId()
+{
+    return lastId++;
+}
+
+template <int W, int H>
+BasicBoard<W, H>::~BasicBoard()
+{
+}
+
+template <int W, int H>
+BallHandle BasicBoard<W, H>::addBall(Ball &b)
+{
+    b.id = newBallId();
+    return insertBall(b);
+}
+
+template <int W, int H>
+BallHandle BasicBoard<W, H>::insertBall(Ball &b)
+{
+    return insertBall(b, eventEngine.getTime());
+}
+
+template <int W, int H>
+BallHandle BasicBoard<W, H>::insertBall(Ball &b, double time)
 {
- //   ball.id = lastId++;
     if (b.px < 0) b.px = 0;
-    if (b.px > BLOCKS_SIZE - 1) b.px = BLOCKS_SIZE - 1;
+    if (b.px > W - 1) b.px = W - 1;
     if (b.py < 0) b.py = 0;
-    if (b.py > BLOCKS_SIZE - 1) b.py = BLOCKS_SIZE - 1;
+    if (b.py > H - 1) b.py = H - 1;
+    
+    if (ballList.full()) return BallHandle::invalid();
+    
+    occupyCell(b.px, b.py, b.r, b.g, b.b);
+    const BallHandle handle = ballList.push(b);
+    
+    if (physicsMode == PhysicsMode_Event)
+    {
+        eventEngine.schedule(handle, time);
+    }
+    
+    return handle;
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::deleteBall(BallHandle handle)
+{
+    const int i = ballList.indexOf(handle);
+    if (i < 0) return;
+    
+    int x, y;
+    if (getBallCell(i, x, y)) vacateCellAt(x, y);
+    ballList.erase(i);
+}
+
+template <int W, int H>
+bool BasicBoard<W, H>::getBall(BallHandle handle, Ball &ball) const
+{
+    const int i = ballList.indexOf(handle);
+    if (i < 0) return false;
+    
+    ball = ballList.get(i);
+    return true;
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::deleteAllBalls()
+{
+    ballList.clear();
+    eventEngine.clear();
+    collider.clear();
+    clearFrame();
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::setMaxBalls(size_t maxBalls)
+{
+    ballList.setCapacity(maxBalls);
+    hitList.reserve(maxBalls);
+    warpIndexList.reserve(maxBalls);
+    warpFlags.reserve(maxBalls);
+    warpBallList.reserve(maxBalls);
+    chunks.reserve(MAX_MOVE_CHUNKS);
+    eventEngine.reserve(maxBalls);
+    collider.setCapacity(maxBalls);
+    
+    for (int d = 0; d < Direction_Num; d++)
+    {
+        outbox[d].reserve(maxBalls);
+    }
+    
+    reservePendingNotes();
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::setPhysicsMode(PhysicsMode mode)
+{
+    if (mode == physicsMode) return;
+    
+    if (mode == PhysicsMode_Event)
+    {
+        physicsMode = mode;
+        eventEngine.setWalls(connectedBoard[Direction_Left] == nullptr, connectedBoard[Direction_Right] == nullptr,
+                             connectedBoard[Direction_Top] == nullptr, connectedBoard[Direction_Bottom] == nullptr);
+        eventEngine.scheduleAll();
+    }
+    else
+    {
+        eventEngine.syncPositions();
+        eventEngine.clear();
+        physicsMode = mode;
+    }
+    
+    rebuildFrame();
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::move()
+{
+    move(0, 0);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::move(double timeMs, double intervalMs)
+{
+    if (! beginMove(timeMs, intervalMs, 1))
+    {
+        // 固定容量モードならここから先で確保してはいけない
+        BOUND_ASSERT_NO_ALLOCATIONS(getMaxBalls() > 0);
+        
+        moveByEvents();
+        return;
+    }
     
-    ballList.push_back(b);
-    return b.id;
+    stepChunk(0);
+    endMove();
 }
 
-void Board::deleteBall(int id)
+template <int W, int H>
+bool BasicBoard<W, H>::beginMove(double timeMs, double intervalMs, int numChunks)
 {
-    for (int i = 0; i < ballList.size(); i++)
+    tickTimeMs = timeMs;
+    tickIntervalMs = intervalMs;
+    tickStartTime = eventEngine.getTime();
+    numCollisionsLastMove = 0;
+    
+    if (physicsMode == PhysicsMode_Event) return false;
+    
+    BOUND_ASSERT_NO_ALLOCATIONS(getMaxBalls() > 0);
+    
+    // ボール同士は進める前にまとめて。速度を変えるだけなので、このあと範囲に分けて進めてもいい
+    if (ballCollisions)
     {
-        if (ballList[i].id == id)
+        numCollisionsLastMove = collider.collide(ballList);
+        
+        const BallContact *contacts = collider.getContacts();
+        for (int c = 0; c < numCollisionsLastMove; c++)
         {
-            ballList.erase(ballList.begin() + i);
-            break;
+            const double hitTimeMs = tickTimeMs > 0 ? tickTimeMs + contacts[c].time * tickIntervalMs : 0;
+            playHitSound(contacts[c].a, hitTimeMs);
+            playHitSound(contacts[c].b, hitTimeMs);
         }
     }
+    
+    const size_t n = ballList.size();
+    numChunks = jlimit(1, MAX_MOVE_CHUNKS, numChunks);
+    
+    hitList.resize(n);
+    warpIndexList.resize(n);
+    chunks.resize(numChunks);
+    
+    // 範囲は詰めて並べる。ボールの順に並ぶので、endMoveでつなげれば分けなかったときと同じ順になる
+    for (int c = 0; c < numChunks; c++)
+    {
+        chunks[c].begin = n * c / numChunks;
+        chunks[c].end = n * (c + 1) / numChunks;
+        chunks[c].numHits = chunks[c].numWarps = 0;
+    }
+    
+    moveWalls = getWallBounds();
+    moveWarpBounds = getWarpBounds();
+    
+    // 盤面は進めたあとの位置から作り直す。ボールを1つずつどかすより速く、
+    // ワープして消えたボールのマスが残ることもない
+    clearFrame();
+    return true;
 }
 
-void Board::deleteAllBalls()
+template <int W, int H>
+void BasicBoard<W, H>::stepChunk(int c)
 {
-    ballList.clear();
+    MoveChunk &chunk = chunks[c];
+    
+    // hitsとwarpsは範囲の先頭から書く。ほかの範囲とは重ならない
+    chunk.numHits = stepBalls(ballList, chunk.begin, chunk.end, moveWalls, moveWarpBounds,
+                              hitList.data() + chunk.begin, warpIndexList.data() + chunk.begin, chunk.numWarps);
 }
 
-void Board::move()
+template <int W, int H>
+void BasicBoard<W, H>::endMove()
 {
+    // 固定容量モードならここから先で確保してはいけない
+    BOUND_ASSERT_NO_ALLOCATIONS(getMaxBalls() > 0);
+    
+    const size_t n = ballList.size();
     warpBallList.clear();
     
-    for (int i = 0; i < ballList.size(); i++)
+    for (size_t i = 0; i < n; i++)
     {
-        auto &b = ballList[i];
-        if (isWall(b.px + b.vx, b.py) || isWall(b.px - b.vx, b.py))
-        {
-            b.vx = -b.vx;
-            if (i == 4)
-            {
-                outManager->playMonologueSound(sequence[seq_i++], 1);
-                seq_i = seq_i % sequence.size();
-            }
-            else
-            {
-                outManager->playVolcaSound(b.noteNum);
-            }
-        }
-        
-        if (isWall(b.px, b.py + b.vy) || isWall(b.px, b.py - b.vy))
+        occupyCell(ballList.px[i], ballList.py[i], ballList.r[i], ballList.g[i], ballList.b[i]);
+    }
+    
+    // 反射した軸ごとに1回鳴らす。Stepではターンの区切りで向きを変えるので、時刻はそのターンの予定時刻
+    int numWarps = 0;
+    for (auto &chunk : chunks)
+    {
+        for (int h = 0; h < chunk.numHits; h++)
         {
-            b.vy = -b.vy;
-            //outManager->playVolcaSound(b.noteNum);
-            if (i == 4)
+            const BallHit &hit = hitList[chunk.begin + h];
+            const int numSounds = ((hit.axes & HitAxis_X) ? 1 : 0) + ((hit.axes & HitAxis_Y) ? 1 : 0);
+            
+            for (int k = 0; k < numSounds; k++)
             {
-                outManager->playMonologueSound(sequence[seq_i++], 1);
-                seq_i = seq_i % sequence.size();
-            }
-            else
-            {
-                outManager->playVolcaSound(b.noteNum);
+                playHitSound(hit.index, tickTimeMs);
             }
         }
         
-        b.px += b.vx;
-        b.py += b.vy;
-        
-        if (isWarpZone(b.px, b.py))
+        numWarps += chunk.numWarps;
+    }
+    
+    if (numWarps == 0) return;
+    
+    warpFlags.assign(n, 0);
+    for (auto &chunk : chunks)
+    {
+        for (int w = 0; w < chunk.numWarps; w++)
         {
-            warpBallList.push_back(b);
+            const int i = warpIndexList[chunk.begin + w];
+            warpBallList.push_back(ballList.get(i));
+            warpFlags[i] = 1;
+            
+            // getCellは盤面のすぐ外(-1 < p < 0など)も端のマスにするので、出ていくボールのぶんは戻しておく
+            vacateCell(ballList.px[i], ballList.py[i]);
         }
     }
+    ballList.eraseIf(warpFlags.data());
     
     for (int i = 0; i < warpBallList.size(); i++)
     {
         auto &b = warpBallList[i];
-        deleteBall(b.id);
         
-        if (b.px < 0)
+        // 角から出たときは、つながっている方に渡す
+        if (b.px < 0 && connectedBoard[Direction_Left] != nullptr)
         {
-            b.px += BLOCKS_SIZE;
-            if (connectedBoard[Direction_Left] != nullptr)
-            {
-                connectedBoard[Direction_Left]->addBall(b);
-            }
+            handOver(b, Direction_Left, eventEngine.getTime());
         }
-        else if (b.px >= BLOCKS_SIZE - 1)
+        else if (b.px >= W - 1 && connectedBoard[Direction_Right] != nullptr)
         {
-            b.px -= BLOCKS_SIZE;
-            if (connectedBoard[Direction_Right] != nullptr)
-            {
-                connectedBoard[Direction_Right]->addBall(b);
-            }
+            handOver(b, Direction_Right, eventEngine.getTime());
         }
         else if (b.py < 0)
         {
-            b.py += BLOCKS_SIZE;
-            if (connectedBoard[Direction_Top] != nullptr)
-            {
-                connectedBoard[Direction_Top]->addBall(b);
-            }
+            handOver(b, Direction_Top, eventEngine.getTime());
+        }
+        else if (b.py >= H - 1)
+        {
+            handOver(b, Direction_Bottom, eventEngine.getTime());
+        }
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::moveByEvents()
+{
+    eventEngine.setWalls(connectedBoard[Direction_Left] == nullptr, connectedBoard[Direction_Right] == nullptr,
+                         connectedBoard[Direction_Top] == nullptr, connectedBoard[Direction_Bottom] == nullptr);
+    eventEngine.advance(1.0, *this);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::ballEvent(const BallEvent &e)
+{
+    const int i = ballList.indexOf(e.handle);
+    if (i < 0) return;
+    
+    switch (e.type)
+    {
+        case BallEvent_Wall:
+            // ターンの中でぶつかった位置に合わせる
+            playHitSound(i, tickTimeMs > 0 ? tickTimeMs + (e.time - tickStartTime) * tickIntervalMs : 0);
+            break;
+            
+        case BallEvent_Cell:
+            vacateCellAt(e.fromX, e.fromY);
+            occupyCellAt(e.toX, e.toY, ballList.r[i], ballList.g[i], ballList.b[i]);
+            break;
+            
+        case BallEvent_Exit:
+        {
+            Ball b = ballList.get(i);
+            vacateCellAt(e.fromX, e.fromY);
+            ballList.erase(i);
+            
+            const bool positive = (e.axis == HitAxis_X ? b.vx : b.vy) > 0;
+            const Direction d = e.axis == HitAxis_X ? (positive ? Direction_Right : Direction_Left)
+                                                    : (positive ? Direction_Bottom : Direction_Top);
+            handOver(b, d, e.time);
+            break;
+        }
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::handOver(Ball &b, Direction d, double time)
+{
+    switch (d)
+    {
+        case Direction_Left:   b.px += W; break;
+        case Direction_Right:  b.px -= W; break;
+        case Direction_Top:    b.py += H; break;
+        case Direction_Bottom: b.py -= H; break;
+        default: return;
+    }
+    
+    if (connectedBoard[d] == nullptr) return;
+    
+    if (deferred)
+    {
+        WarpingBall w;
+        w.ball = b;
+        w.time = time;
+        outbox[d].push_back(w);
+        return;
+    }
+    
+    connectedBoard[d]->insertBall(b, time);
+}
+
+template <int W, int H>
+int BasicBoard<W, H>::deliverWarps()
+{
+    int delivered = 0;
+    
+    // 方向の順、出ていった順に渡す。スレッドの数に関係なく同じ順になる
+    for (int d = 0; d < Direction_Num; d++)
+    {
+        BasicBoard *to = connectedBoard[d];
+        
+        for (auto &w : outbox[d])
+        {
+            if (to == nullptr) break; // 渡す前に外された
+            
+            to->insertBall(w.ball, w.time);
+            delivered++;
+        }
+        
+        outbox[d].clear();
+    }
+    
+    return delivered;
+}
+
+template <int W, int H>
+int BasicBoard<W, H>::flushNotes()
+{
+    for (auto &e : pendingNotes)
+    {
+        outManager->playNote(e.device, e.channel, e.note, e.velocity, e.gate, e.time);
+    }
+    
+    const int n = (int) pendingNotes.size();
+    pendingNotes.clear();
+    return n;
+}
+
+template <int W, int H>
+uint64_t BasicBoard<W, H>::getChecksum() const
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    
+    auto add = [&h] (const void *data, size_t size)
+    {
+        const uint8_t *p = (const uint8_t*) data;
+        for (size_t i = 0; i < size; i++)
+        {
+            h = (h ^ p[i]) * 1099511628211ull;
+        }
+    };
+    
+    for (size_t i = 0; i < ballList.size(); i++)
+    {
+        add(&ballList.px[i], sizeof(float));
+        add(&ballList.py[i], sizeof(float));
+        add(&ballList.vx[i], sizeof(float));
+        add(&ballList.vy[i], sizeof(float));
+        add(&ballList.r[i], sizeof(float));
+        add(&ballList.g[i], sizeof(float));
+        add(&ballList.b[i], sizeof(float));
+        add(&ballList.noteNum[i], sizeof(int));
+    }
+    
+    return h;
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::reservePendingNotes()
+{
+    // 1回の衝突で積む音は行き先の数だけ。1ターンに何回ぶつかるかは決まらないので、ボールあたりの見積もりで切る
+    maxPendingNotes = getMaxBalls() * MAX_HIT_SOUNDS_PER_BALL * (size_t) routes.getMaxTargetsPerTrack();
+    pendingNotes.reserve(maxPendingNotes);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::playHitSound(size_t i, double timeMs)
+{
+    int numTargets;
+    const RouteTarget *targets = routes.find(ballList.noteNum[i], numTargets);
+    
+    for (int t = 0; t < numTargets; t++)
+    {
+        const RouteTarget &target = targets[t];
+        int note = target.note;
+        
+        if (note == ROUTE_NOTE_SEQUENCE)
+        {
+            note = sequence[seq_i++];
+            seq_i = seq_i % sequence.size();
         }
-        else if (b.py >= BLOCKS_SIZE - 1)
+        
+        if (deferred)
         {
-            b.py -= BLOCKS_SIZE;
-            if (connectedBoard[Direction_Bottom] != nullptr)
+            if (getMaxBalls() > 0 && pendingNotes.size() >= maxPendingNotes)
             {
-                connectedBoard[Direction_Bottom]->addBall(b);
+                numDroppedNotes++;
+                continue;
             }
+            
+            NoteEvent e;
+            e.device = target.device;
+            e.channel = target.channel;
+            e.note = note;
+            e.velocity = target.velocity;
+            e.gate = target.gate;
+            e.time = timeMs;
+            e.queued = 0;
+            pendingNotes.push_back(e);
+            continue;
         }
+        
+        outManager->playNote(target.device, target.channel, note, target.velocity, target.gate, timeMs);
     }
 }
 
+template <int W, int H>
+WallBounds BasicBoard<W, H>::getWallBounds() const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    
+    WallBounds w;
+    w.xMin = connectedBoard[Direction_Left]   == nullptr ? 0.f : -inf;
+    w.xMax = connectedBoard[Direction_Right]  == nullptr ? (float)(W - 1) : inf;
+    w.yMin = connectedBoard[Direction_Top]    == nullptr ? 0.f : -inf;
+    w.yMax = connectedBoard[Direction_Bottom] == nullptr ? (float)(H - 1) : inf;
+    return w;
+}
+
+template <int W, int H>
+WallBounds BasicBoard<W, H>::getWarpBounds() const
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    
+    WallBounds w;
+    w.xMin = connectedBoard[Direction_Left]   != nullptr ? 0.f : -inf;
+    w.xMax = connectedBoard[Direction_Right]  != nullptr ? (float)(W - 1) : inf;
+    w.yMin = connectedBoard[Direction_Top]    != nullptr ? 0.f : -inf;
+    w.yMax = connectedBoard[Direction_Bottom] != nullptr ? (float)(H - 1) : inf;
+    return w;
+}
 
-void Board::connect(Board *b, Direction d)
+template <int W, int H>
+void BasicBoard<W, H>::connect(BasicBoard *b, Direction d)
 {
     connectedBoard[d] = b;
 }
 
-void Board::disConnect(Direction d)
+template <int W, int H>
+void BasicBoard<W, H>::disConnect(Direction d)
 {
     connectedBoard[d] = nullptr;
 }
+
+template <int W, int H>
+bool BasicBoard<W, H>::getCell(float px, float py, int &x, int &y) const
+{
+    // getBoardStateの(int)b.px == xと同じ切り捨て
+    if (!(px > -1.f && px < W && py > -1.f && py < H)) return false;
+    
+    x = (int)px;
+    y = (int)py;
+    return true;
+}
+
+template <int W, int H>
+bool BasicBoard<W, H>::getBallCell(size_t i, int &x, int &y) const
+{
+    if (physicsMode == PhysicsMode_Event)
+    {
+        return eventEngine.getCell(ballList.getHandle(i), x, y);
+    }
+    
+    return getCell(ballList.px[i], ballList.py[i], x, y);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::occupyCell(float px, float py, float r, float g, float b)
+{
+    int x, y;
+    if (getCell(px, py, x, y)) occupyCellAt(x, y, r, g, b);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::vacateCell(float px, float py)
+{
+    int x, y;
+    if (getCell(px, py, x, y)) vacateCellAt(x, y);
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::occupyCellAt(int x, int y, float r, float g, float b)
+{
+    // 同じマスに複数いるときは最後に入ってきたボールの色
+    occupancy[x][y]++;
+    frame[x][y].r = r;
+    frame[x][y].g = g;
+    frame[x][y].b = b;
+    frame[x][y].c = Charactor_Ball;
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::vacateCellAt(int x, int y)
+{
+    if (occupancy[x][y] == 0) return;
+    
+    if (--occupancy[x][y] == 0)
+    {
+        frame[x][y].r = frame[x][y].g = frame[x][y].b = 0;
+        frame[x][y].c = Charactor_Nothing;
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::clearFrame()
+{
+    for (int x = 0; x < W; x++)
+    {
+        for (int y = 0; y < H; y++)
+        {
+            occupancy[x][y] = 0;
+            frame[x][y].r = frame[x][y].g = frame[x][y].b = 0;
+            frame[x][y].c = Charactor_Nothing;
+        }
+    }
+}
+
+template <int W, int H>
+void BasicBoard<W, H>::rebuildFrame()
+{
+    clearFrame();
+    
+    for (size_t i = 0; i < ballList.size(); i++)
+    {
+        int x, y;
+        if (getBallCell(i, x, y)) occupyCellAt(x, y, ballList.r[i], ballList.g[i], ballList.b[i]);
+    }
+}
+
+// 使う大きさだけここで実体化する。定義をヘッダーに出さずに済む
+template class game::BasicBoard<BLOCKS_SIZE, BLOCKS_SIZE>;
+template class game::BasicBoard<CANVAS_SIZE, CANVAS_SIZE>;
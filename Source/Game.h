@@ -8,13 +8,20 @@
 #pragma once
 
 #include <vector>
+#include <limits>
+#include <atomic>
 #include "MidiOutManager.h"
+#include "MidiRouting.h"
+#include "BallStore.h"
+#include "EventEngine.h"
+#include "BallCollider.h"
+#include "AllocationCounter.h"
 
 #define BLOCKS_SIZE 15
+#define MAX_BALLS_PER_BOARD 4096 // 固定容量モードでの1ボードあたりのボール数
 #define LEDDECAY 0.7 // 減衰速度の乗数
-
-#define NAMESPACE_GAME_BEGIN namespace game {
-#define NAMESPACE_GAME_END   }
+#define MAX_MOVE_CHUNKS 64 // beginMoveで1ターンを分けられる数
+#define MAX_HIT_SOUNDS_PER_BALL 4 // 固定容量モードで1ターンにためておける音の数(ボールあたり、行き先1つあたり)。超えたぶんは捨てる
 
 NAMESPACE_GAME_BEGIN
 struct Ball
@@ -23,7 +30,7 @@ struct Ball
     float vx, vy; // 速度
     float r, g, b;
     int lifespan; // 何ターンで消えるのか(-1で無限)
-    int id;
+    int id; // addBallで振られる。全ボードで一意
     int noteNum; // volca sampleに繋いだときはchとして使う
 };
 
@@ -50,40 +57,126 @@ struct BoardState
     Charactor c; // 名前よくない。ボードのこの位置に何があるのか。
 };
 
-class Board
+enum PhysicsMode
+{
+    PhysicsMode_Step = 0, // 毎ターン全部のボールを1歩ずつ進める(元からの動き)
+    PhysicsMode_Event,    // EventEngineで次の衝突まで一気に進める。衝突時刻はターン内の小数まで出る
+};
+
+int newBallId(); // addBallで振るid。盤面の大きさが違うボードの間でも一意
+
+// W x Hマスの盤面。大きさはコンパイル時に決まるので、マスを回るループや壁の判定は定数になる。
+// Lightpad 1枚ぶんはBoard。ほかの大きさはGame.cppで明示的に実体化したものだけ使える
+template <int W, int H>
+class BasicBoard : private EventEngine::Listener
 {
 public:
-    Board()
+    enum
     {
+        width = W,
+        height = H,
+        numCells = W * H
+    };
+    
+    typedef BoardState Frame[W][H]; // [x][y]で引く。1フレーム分の盤面
+    
+    // maxBallsを渡すと固定容量モード。全部先に確保しておき、moveの中ではヒープを触らない。
+    // いっぱいのときのaddBallとワープしてきたボール、ためきれない音は捨てる。
+    explicit BasicBoard(size_t maxBalls = 0)
+        : eventEngine(ballList, W, H)
+    {
+        physicsMode = PhysicsMode_Step;
+        maxPendingNotes = 0;
+        numDroppedNotes = 0;
+        setMaxBalls(maxBalls);
+        
         for (int i = 0; i < Direction_Num; i++)
         {
             connectedBoard[i] = nullptr;
         }
             
-        lastId = 0;
         seq_i = 0;
+        deferred = false;
+        ballCollisions = false;
+        numCollisionsLastMove = 0;
+        tickTimeMs = tickIntervalMs = tickStartTime = 0;
+        clearFrame();
         outManager = &MidiOutManager::getSharedInstance();
+        // 配線は空。デバイスを開くのは持ち主(MainComponent、HeadlessEngine)で、setRoutesで渡す
         
         sequence = {40, 42, 44, 46, 48, 50, 52, 50, 48, 46, 44, 42};
     }
     
-    ~Board();
+    ~BasicBoard();
     
-    int addBall(Ball &ball); // ボールを置く。idを返す。
-    void deleteBall(int id);
+    BallHandle addBall(Ball &ball); // ボールを置く。ball.idを振ってハンドルを返す。
+    void deleteBall(BallHandle handle);
     void deleteAllBalls(void);
     
+    bool getBall(BallHandle handle, Ball &ball) const; // 無効なハンドルならfalse
+    size_t getNumBalls() const { return ballList.size(); }
+    
+    void setMaxBalls(size_t maxBalls); // 0なら上限なし(必要なだけ確保する)
+    size_t getMaxBalls() const { return ballList.getCapacity(); }
+    
+    // 衝突をどこに送るか。ゲームを進めるスレッドと同時に呼ばないこと
+    // MidiRouting::compileしたもの。渡すまでは音を出さない
+    void setRoutes(const BoardRoutes &newRoutes) { routes = newRoutes; reservePendingNotes(); }
+    const BoardRoutes& getRoutes() const { return routes; }
+    
     void move(); // タイマーとか呼び出す。ゲームを進める。
     
-    void connect(Board *b, Direction d);
+    // tickTimeMsはこのターンの予定時刻(Time::getMillisecondCounterHiRes()の値)、tickIntervalMsは1ターンの長さ。
+    // 衝突の音はターンの中で実際にぶつかった時刻に合わせて予約される。
+    void move(double tickTimeMs, double tickIntervalMs);
+    
+    // moveをボールの範囲ごとに分けてやる。ボールの多いボードをBoardWorldが何スレッドかで進めるときに使う。
+    // beginMoveのあと、stepChunk(0 .. numChunks - 1)は別々のスレッドから同時に呼んでいい。全部終わったらendMove。
+    // 結果は分けずにmoveしたときと同じ。PhysicsMode_Eventは分けられないのでfalseを返す(そのときはmoveを使う)
+    bool beginMove(double tickTimeMs, double tickIntervalMs, int numChunks);
+    void stepChunk(int chunk);
+    void endMove();
+    
+    // PhysicsMode_Eventにするときは、つながっているボードも同時に切り替えること(時刻を共有するため)
+    void setPhysicsMode(PhysicsMode mode);
+    PhysicsMode getPhysicsMode() const { return physicsMode; }
+    
+    // ボール同士をぶつける。ぶつかった2つはそれぞれの音を鳴らす。PhysicsMode_Stepのときだけ効く
+    void setBallCollisions(bool shouldCollide) { ballCollisions = shouldCollide; }
+    bool getBallCollisions() const { return ballCollisions; }
+    void setBallRadius(float radius) { collider.setRadius(radius); }
+    int getNumCollisionsLastMove() const { return numCollisionsLastMove; }
+    
+    // 同じ大きさのボードとだけつなげる
+    void connect(BasicBoard *b, Direction d);
     void disConnect(Direction d);
+    BasicBoard* getConnectedBoard(Direction d) const { return connectedBoard[d]; }
+    
+    // trueにすると、moveの中ではとなりにボールを渡さず、衝突の音も送らずにためておく。
+    // ほかのボードに触らなくなるので、ボードごとに別のスレッドでmoveできる(BoardWorldが使う)。
+    void setDeferred(bool shouldDefer) { deferred = shouldDefer; }
+    bool isDeferred() const { return deferred; }
+    
+    // ためておいたボールをつながっているボードに渡す。渡した数を返す。
+    // 渡す先のボードのmoveと同時に呼ばないこと。
+    int deliverWarps();
+    
+    // ためておいた衝突の音をMidiOutManagerに積む。積むスレッドはひとつだけにすること(SPSC)
+    int flushNotes();
+    
+    // 固定容量モードで、ためきれずに捨てた音の数(累計)。
+    // ためておけるのは maxBalls * MAX_HIT_SOUNDS_PER_BALL * 配線の1トラックの行き先の最大
+    int64 getNumDroppedNotes() const { return numDroppedNotes; }
+    
+    // ボールの位置、速度、色のハッシュ(idは入れない)。同じ盤面なら同じ値
+    uint64_t getChecksum() const;
     
     bool isWall(float x, float y)
     {
         if ((x < 0 && connectedBoard[Direction_Left] == nullptr) ||
-            (x > BLOCKS_SIZE - 1 && connectedBoard[Direction_Right] == nullptr) ||
+            (x > W - 1 && connectedBoard[Direction_Right] == nullptr) ||
             (y < 0 && connectedBoard[Direction_Top] == nullptr) ||
-            (y > BLOCKS_SIZE - 1 && connectedBoard[Direction_Bottom] == nullptr))
+            (y > H - 1 && connectedBoard[Direction_Bottom] == nullptr))
         {
             return true;
         }
@@ -94,9 +187,9 @@ public:
     bool isWarpZone(float x, float y)
     {
         if ((x < 0 && connectedBoard[Direction_Left] != nullptr) ||
-            (x > BLOCKS_SIZE - 1 && connectedBoard[Direction_Right] != nullptr) ||
+            (x > W - 1 && connectedBoard[Direction_Right] != nullptr) ||
             (y < 0 && connectedBoard[Direction_Top] != nullptr) ||
-            (y > BLOCKS_SIZE - 1 && connectedBoard[Direction_Bottom] != nullptr))
+            (y > H - 1 && connectedBoard[Direction_Bottom] != nullptr))
         {
             return true;
         }
@@ -106,39 +199,98 @@ public:
     
     BoardState getBoardState(unsigned int x, unsigned int y)
     {
-        BoardState result;
-        
-        if (isWall(x, y))
+        if (isWall(x, y) || x >= W || y >= H)
         {
+            BoardState result;
+            result.r = result.g = result.b = 0;
             result.c = Charactor_Wall;
             return result;
         }
         
-        for (auto b : ballList)
-        {
-            if ((int)b.px == x && (int)b.py == y)
-            {
-                result.r = b.r;
-                result.g = b.g;
-                result.b = b.b;
-                result.c = Charactor_Ball;
-                return result;
-            }
-        }
-        
-        result.c = Charactor_Nothing;
-        return result;
+        return frame[x][y];
+    }
+    
+    // 盤面全体をまとめて返す。moveのたびに差分で更新されている
+    const Frame& getBoardFrame() const
+    {
+        return frame;
     }
     
-        int lastId;
 private:
-    Board *connectedBoard[Direction_Num];
-    std::vector<Ball> ballList;
+    BallHandle insertBall(Ball &ball); // idはそのまま。ワープしてきたボールもこれで受け取る
+    BallHandle insertBall(Ball &ball, double time); // PhysicsMode_Eventのとき、ballの位置がtimeの時点のもの
+    void handOver(Ball &ball, Direction d, double time); // となりのボードに渡す
+    void playHitSound(size_t index, double timeMs);
+    void reservePendingNotes(); // 容量と配線からmaxPendingNotesを決めて確保しておく
+    
+    void moveByEvents();
+    void ballEvent(const BallEvent &event) override;
+    
+    bool getCell(float px, float py, int &x, int &y) const; // ボールがいるマス。盤面の外ならfalse
+    bool getBallCell(size_t index, int &x, int &y) const;
+    void occupyCell(float px, float py, float r, float g, float b);
+    void vacateCell(float px, float py);
+    void occupyCellAt(int x, int y, float r, float g, float b);
+    void vacateCellAt(int x, int y);
+    void clearFrame();
+    void rebuildFrame();
+    
+    // 壁とワープゾーンの境界。つながっていない方向が壁
+    WallBounds getWallBounds() const;
+    WallBounds getWarpBounds() const;
+    
+    BasicBoard *connectedBoard[Direction_Num];
+    
+    // deferredのときにためておくもの
+    struct WarpingBall
+    {
+        Ball ball;   // 渡す先のボードでの位置
+        double time; // PhysicsMode_Eventのときの、ballの位置の時刻
+    };
+    std::vector<WarpingBall> outbox[Direction_Num];
+    std::vector<NoteEvent> pendingNotes;
+    size_t maxPendingNotes; // 固定容量モードでためておける音の数
+    int64 numDroppedNotes;  // ためきれずに捨てた音(累計)
+    bool deferred;
+    BallStore ballList;
+    EventEngine eventEngine;
+    PhysicsMode physicsMode;
+    BallCollider collider;
+    bool ballCollisions;
+    int numCollisionsLastMove;
     std::vector<Ball> warpBallList;
+    std::vector<BallHit> hitList;   // stepBallsの出力先
+    std::vector<int> warpIndexList; // 同上
+    std::vector<char> warpFlags;
+    
+    // beginMoveで分けた範囲。hitsとwarpsはhitList、warpIndexListの[begin, begin + numHits)に入る
+    struct MoveChunk
+    {
+        size_t begin, end;
+        int numHits, numWarps;
+    };
+    std::vector<MoveChunk> chunks;
+    WallBounds moveWalls, moveWarpBounds;
+    Frame frame;
+    int occupancy[W][H]; // マスごとのボールの数
     MidiOutManager *outManager;
+    BoardRoutes routes;
     
     std::vector<int> sequence;
     int seq_i;
+    
+    double tickTimeMs;     // 今進めているターンの時刻。0なら時刻を指定せずにすぐ鳴らす
+    double tickIntervalMs;
+    double tickStartTime;  // そのときのeventEngineの時刻
 };
 
+#define CANVAS_SIZE 64 // Lightpadを何枚かまとめて1枚の盤面として扱うときの大きさ
+
+typedef BasicBoard<BLOCKS_SIZE, BLOCKS_SIZE> Board;  // Lightpad 1枚
+typedef BasicBoard<CANVAS_SIZE, CANVAS_SIZE> CanvasBoard;
+typedef Board::Frame BoardFrame;
+
+extern template class BasicBoard<BLOCKS_SIZE, BLOCKS_SIZE>;
+extern template class BasicBoard<CANVAS_SIZE, CANVAS_SIZE>;
+
 NAMESPACE_GAME_END
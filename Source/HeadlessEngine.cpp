@@ -0,0 +1,487 @@
+//
+//  HeadlessEngine.cpp
+//  Bound - App
+//
+
+#include "HeadlessEngine.h"
+
+using namespace game;
+
+namespace
+{
+    // 明るさ1のColour::fromHSVと同じ値。Colourはjuce_graphicsにあるので、コンソールのビルドでは使えない
+    void hueToRGB (float h, float s, float& r, float& g, float& b)
+    {
+        const float v = 255.0f;
+        const float intV = (float) roundToInt (v);
+
+        h = (h - std::floor (h)) * 6.0f + 0.00001f;
+        const float f = h - std::floor (h);
+        const float x = (float) roundToInt (v * (1.0f - s));
+        const float rising = (float) roundToInt (v * (1.0f - (s * (1.0f - f))));
+        const float falling = (float) roundToInt (v * (1.0f - s * f));
+
+        if      (h < 1.0f) { r = intV;    g = rising;  b = x; }
+        else if (h < 2.0f) { r = falling; g = intV;    b = x; }
+        else if (h < 3.0f) { r = x;       g = intV;    b = rising; }
+        else if (h < 4.0f) { r = x;       g = falling; b = intV; }
+        else if (h < 5.0f) { r = rising;  g = x;       b = intV; }
+        else               { r = intV;    g = x;       b = falling; }
+    }
+}
+
+HeadlessEngine::HeadlessEngine (const Options& options)
+{
+    const int columns = jlimit (1, MAX_RENDER_BOARDS, options.boardColumns);
+    const int rows = jlimit (1, MAX_RENDER_BOARDS / columns, (jmax (options.numBoards, options.numVirtualPads) + columns - 1) / columns);
+
+    // デバイスを開く前に送り先を決めておく。MidiOutManagerはひとつなので、先に開いた名前はそのバックエンドのまま
+    MidiOutManager& outManager = MidiOutManager::getSharedInstance();
+    outManager.setDefaultBackend (options.midiBackend);
+    midiBackend = options.midiBackend;
+
+    // 縦横に並べてとなり同士をつなぐ
+    world = new BoardWorld (columns, rows, MAX_BALLS_PER_BOARD);
+    world->connectGrid();
+    world->setBallCollisions (options.ballCollisions);
+    scheduler = new TaskScheduler (options.numThreads);
+    world->setScheduler (scheduler);
+    renderPipeline.setScheduler (scheduler);
+
+    const int numBoards = world->getNumBoards();
+
+    // midi。設定ファイルがなければ元の配線(volcaとmonologue)
+    MidiRouting routing = MidiRouting::createDefault();
+    routing.loadFromFile (options.routingFile);
+
+    if (options.measureMidiLatency)
+    {
+        midiLatency = new MidiLatencyMonitor();
+        outManager.setCaptureEnabled (true);
+    }
+
+    routing.apply (outManager);
+
+    for (int i = 0; i < numBoards; i++)
+        world->getBoard (i)->setRoutes (routing.compile (i, outManager));
+
+    if (options.bpm > 0)
+        simulationClock.setBpm (options.bpm);
+
+    addRandomBalls (options.numBalls, options.seed);
+
+    if (options.useBlocks)
+    {
+        topologySource = new PhysicalTopologySource();
+        topologySource->addListener (this);
+    }
+
+    if (options.numVirtualPads > 0)
+    {
+        virtualTopology = new VirtualTopologySource();
+        virtualTopology->addListener (this);
+        virtualTopology->setNumPads (jmin (options.numVirtualPads, numBoards), options.virtualPadsPerRow);
+
+        if (options.scriptFile != File() && ! virtualTopology->loadScript (options.scriptFile))
+            DBG ("HeadlessEngine: couldn't read all of " << options.scriptFile.getFullPathName());
+
+        virtualTopology->addRandomFlicks (options.seed, options.virtualFlicksPerSecond, options.virtualScriptLengthMs);
+    }
+}
+
+HeadlessEngine::~HeadlessEngine()
+{
+    stop();
+
+    if (midiLatency != nullptr)
+        MidiOutManager::getSharedInstance().setCaptureEnabled (false);
+
+    if (topologySource != nullptr)
+        topologySource->removeListener (this);
+
+    if (virtualTopology != nullptr)
+        virtualTopology->removeListener (this);
+
+    detachBlocks();
+}
+
+void HeadlessEngine::start()
+{
+    // 台本の時刻はここから数える
+    startTime = Time::getMillisecondCounterHiRes();
+
+    if (virtualTopology != nullptr)
+        virtualTopology->rewind();
+
+    renderPipeline.start();
+    startTimer (LED_POLL_INTERVAL_MS);
+    simulationClock.start();
+}
+
+void HeadlessEngine::stop()
+{
+    simulationClock.stop();
+    renderPipeline.stop();
+    stopTimer();
+}
+
+void HeadlessEngine::runTicks (int numTicks)
+{
+    const double interval = simulationClock.getTickInterval();
+
+    if (virtualTopology != nullptr)
+        virtualTopology->rewind();
+
+    for (int64 tick = 0; tick < numTicks; tick++)
+    {
+        // 台本の時刻はターンで数える。実時間の揺れでタッチがとなりのターンにずれない
+        if (virtualTopology != nullptr)
+            virtualTopology->advance ((double) tick * interval);
+
+        simulationTick (tick, Time::getMillisecondCounterHiRes());
+        renderPipeline.compose();
+        transmitFrame();
+
+        if (midiLatency != nullptr)
+            midiLatency->drain (MidiOutManager::getSharedInstance());
+
+        numTicksRun++;
+    }
+}
+
+void HeadlessEngine::addRandomBalls (int numBalls, int64 seed)
+{
+    Random random (seed);
+
+    const ScopedLock sl (boardLock);
+
+    for (int i = 0; i < numBalls; i++)
+    {
+        Ball ball;
+        ball.px = (float) random.nextInt (Range<int> (1, BLOCKS_SIZE - 1));
+        ball.py = (float) random.nextInt (Range<int> (1, BLOCKS_SIZE - 1));
+        ball.vx = (float) random.nextInt (Range<int> (-2, 3));
+        ball.vy = (float) random.nextInt (Range<int> (-2, 3));
+        if (ball.vx == 0 && ball.vy == 0) ball.vx = 1;
+
+        hueToRGB (random.nextFloat(), 0.8f, ball.r, ball.g, ball.b);
+        ball.lifespan = -1;
+        ball.noteNum = i % 16;
+
+        world->getBoard (i % world->getNumBoards())->addBall (ball);
+    }
+}
+
+void HeadlessEngine::launchBall (int boardIndex, int x, int y, int fromX, int fromY)
+{
+    if (! isPositiveAndBelow (boardIndex, world->getNumBoards()))
+        return;
+
+    Ball ball;
+    ball.px = x;
+    ball.py = y;
+    ball.vx = (float) (fromX - x) / 2.f;
+    ball.vy = (float) (fromY - y) / 2.f;
+    ball.r = 255;
+    ball.g = 255;
+    ball.b = 255;
+    ball.lifespan = -1;
+    ball.noteNum = MidiRouting::getLaunchTrack (numBallsLaunched++);
+
+    const ScopedLock sl (boardLock);
+    world->getBoard (boardIndex)->addBall (ball);
+}
+
+//==============================================================================
+void HeadlessEngine::simulationTick (int64 tickIndex, double tickTimeMs)
+{
+    const double interval = simulationClock.getTickInterval();
+
+    const ScopedLock sl (boardLock);
+    const double start = Time::getMillisecondCounterHiRes();
+
+    world->move (tickTimeMs, interval);
+    numCollisions += world->getNumCollisionsLastMove();
+
+    renderPipeline.publish (world->getBoards(), world->getNumBoards(), tickIndex, tickTimeMs,
+                            Time::getMillisecondCounterHiRes() - start);
+}
+
+void HeadlessEngine::timerCallback()
+{
+    // 台本のタッチはここで送る。実機と同じくメッセージスレッドに、このタイマーの間隔の粒度で届く
+    if (virtualTopology != nullptr)
+        virtualTopology->advance (Time::getMillisecondCounterHiRes() - startTime);
+
+    if (midiLatency != nullptr)
+        midiLatency->drain (MidiOutManager::getSharedInstance());
+
+    transmitFrame();
+}
+
+void HeadlessEngine::transmitFrame()
+{
+    const ComposedFrame* frame;
+    if (! renderPipeline.acquire (frame))
+        return;
+
+    const double start = Time::getMillisecondCounterHiRes();
+    ledRenderer.render (*frame);
+
+    for (auto* a : attachedPads)
+        if (a->boardIndex < frame->numBoards)
+            a->pad->receiveFrame (frame->rgb565[a->boardIndex], frame->tickIndex);
+
+    renderPipeline.finishedTransmit (*frame, Time::getMillisecondCounterHiRes() - start);
+}
+
+//==============================================================================
+void HeadlessEngine::detachBlock (Attachment& a)
+{
+    if (auto surface = a.block->getTouchSurface())
+        surface->removeListener (this);
+
+    for (auto button : a.block->getButtons())
+        button->removeListener (this);
+
+    ledRenderer.removeBlock (*a.block);
+}
+
+void HeadlessEngine::detachBlocks()
+{
+    for (auto* a : attachedBlocks)
+        detachBlock (*a);
+
+    attachedBlocks.clear();
+    ledRenderer.clear();
+}
+
+void HeadlessEngine::topologyChanged()
+{
+    if (topologySource == nullptr)
+        return;
+
+    // 変わったブロックだけ付け外しする。ボードのつなぎ方はコマンドラインの格子のまま、向きだけBlockLayoutから取る
+    const auto topology = topologySource->getCurrentTopology();
+    blockLayout.update (topology);
+
+    for (int i = attachedBlocks.size(); --i >= 0;)
+    {
+        auto* a = attachedBlocks.getUnchecked (i);
+
+        if (blockLayout.find (a->block->uid) == nullptr)
+        {
+            detachBlock (*a);
+            attachedBlocks.remove (i);
+        }
+    }
+
+    for (auto b : topology.blocks)
+    {
+        if (b->getType() != Block::Type::lightPadBlock || findAttachment (*b) != nullptr)
+            continue;
+
+        const int boardIndex = getFreeBoardIndex();
+        if (boardIndex < 0)
+            break;
+
+        auto* a = attachedBlocks.add (new Attachment());
+        a->block = b;
+        a->pad = nullptr;
+        a->boardIndex = boardIndex;
+        a->rotation = 0;
+        a->scaleX = a->scaleY = 0;
+        a->isTap = false;
+        a->fromX = a->fromY = 0;
+
+        if (auto grid = b->getLEDGrid())
+        {
+            a->scaleX = (float) (grid->getNumColumns() - 1) / b->getWidth();
+            a->scaleY = (float) (grid->getNumRows() - 1)    / b->getHeight();
+
+            b->setProgram (new BallTrailProgram (*b));
+            ledRenderer.invalidate (*b);
+        }
+
+        if (auto surface = b->getTouchSurface())
+            surface->addListener (this);
+
+        for (auto button : b->getButtons())
+            button->addListener (this);
+    }
+
+    for (auto* a : attachedBlocks)
+    {
+        if (auto* placement = blockLayout.find (a->block->uid))
+            a->rotation = placement->rotation;
+
+        if (a->block->getLEDGrid() != nullptr)
+            ledRenderer.addBlock (a->block, a->boardIndex, a->rotation);
+    }
+}
+
+HeadlessEngine::Attachment* HeadlessEngine::findAttachment (const Block& block) const
+{
+    for (auto* a : attachedBlocks)
+        if (a->block->uid == block.uid)
+            return a;
+
+    return nullptr;
+}
+
+int HeadlessEngine::getFreeBoardIndex() const
+{
+    for (int boardIndex = 0; boardIndex < world->getNumBoards(); boardIndex++)
+    {
+        bool used = false;
+
+        for (auto* a : attachedBlocks)
+            used = used || a->boardIndex == boardIndex;
+
+        if (! used)
+            return boardIndex;
+    }
+
+    return -1;
+}
+
+void HeadlessEngine::touchChanged (TouchSurface& surface, const TouchSurface::Touch& touch)
+{
+    for (auto* a : attachedBlocks)
+    {
+        if (a->block.get() == &surface.block)
+        {
+            // ブロックの向きから盤面のマスにする
+            int x, y;
+            BlockLayout::blockToBoard (a->rotation,
+                                       jlimit (0, BLOCKS_SIZE - 1, roundToInt (touch.x * a->scaleX)),
+                                       jlimit (0, BLOCKS_SIZE - 1, roundToInt (touch.y * a->scaleY)), x, y);
+            handleTouch (*a, x, y, touch.z > 0.4);
+            return;
+        }
+    }
+}
+
+void HeadlessEngine::handleTouch (Attachment& a, int x, int y, bool pressed)
+{
+    if (a.isTap && ! pressed)
+    {
+        if (a.fromX != x && a.fromY != y)
+            launchBall (a.boardIndex, x, y, a.fromX, a.fromY);
+
+        a.isTap = false;
+    }
+    else if (pressed && ! a.isTap)
+    {
+        a.isTap = true;
+        a.fromX = x;
+        a.fromY = y;
+    }
+}
+
+void HeadlessEngine::buttonReleased (ControlButton&, Block::Timestamp)
+{
+    clearTrails();
+}
+
+void HeadlessEngine::clearTrails()
+{
+    renderPipeline.clearTrails();
+    ledRenderer.clearLEDs();
+}
+
+//==============================================================================
+void HeadlessEngine::virtualTopologyChanged()
+{
+    attachedPads.clear();
+
+    for (int i = 0; i < virtualTopology->getNumPads(); i++)
+    {
+        auto* a = attachedPads.add (new Attachment());
+        a->pad = virtualTopology->getPad (i);
+        a->boardIndex = jmin (i, world->getNumBoards() - 1);
+        a->rotation = 0;
+        a->scaleX = a->scaleY = 1.0f; // 台本はLEDのマスで書く
+        a->isTap = false;
+        a->fromX = a->fromY = 0;
+    }
+}
+
+void HeadlessEngine::virtualTouchChanged (VirtualLightpad& pad, float x, float y, float z)
+{
+    if (auto* a = attachedPads[pad.getIndex()])
+        handleTouch (*a, roundToInt (x * a->scaleX), roundToInt (y * a->scaleY), z > 0.4f);
+}
+
+void HeadlessEngine::virtualButtonReleased (VirtualLightpad&)
+{
+    clearTrails();
+}
+
+uint32 HeadlessEngine::getVirtualChecksum() const
+{
+    uint32 checksum = 0;
+
+    for (auto* a : attachedPads)
+        checksum = checksum * 31 + a->pad->getChecksum();
+
+    return checksum;
+}
+
+StringArray HeadlessEngine::getMidiDevicesOnOtherBackends() const
+{
+    const MidiOutManager& outManager = MidiOutManager::getSharedInstance();
+    StringArray names;
+
+    for (int d = 0; d < outManager.getNumDevices(); d++)
+    {
+        const String name = outManager.getDeviceName (d);
+
+        // 名前で送り先を指定したものはそのまま
+        if (name.startsWith ("virtual:") || name.startsWith ("capture:"))
+            continue;
+
+        if (outManager.getDeviceBackend (d) != midiBackend)
+            names.add (name);
+    }
+
+    return names;
+}
+
+//==============================================================================
+String HeadlessEngine::getStatus()
+{
+    size_t numBalls = 0;
+    int64 collisions = 0, droppedNotes = 0;
+    {
+        const ScopedLock sl (boardLock);
+        for (int i = 0; i < world->getNumBoards(); i++)
+            numBalls += world->getBoard (i)->getNumBalls();
+
+        collisions = numCollisions;
+        droppedNotes = world->getNumDroppedNotes();
+    }
+
+    auto formatLatency = [this] (const char* name, RenderPipeline::Stage stage)
+    {
+        const auto l = renderPipeline.getLatency (stage);
+        return String (name) + " " + String (l.average, 2) + "/" + String (l.max, 2) + "ms";
+    };
+
+    return "ticks " + String (simulationClock.getTickCount() + numTicksRun)
+         + " (dropped " + String (simulationClock.getNumDroppedTicks()) + ")"
+         + ", balls " + String ((int64) numBalls)
+         + (world->getBallCollisions() ? ", collisions " + String (collisions) : String())
+         + ", blocks " + String (attachedBlocks.size())
+         + (virtualTopology != nullptr ? ", virtual pads " + String (attachedPads.size())
+                                           + " (events " + String (virtualTopology->getNumEventsDelivered()) + "/" + String (virtualTopology->getNumEvents())
+                                           + ", checksum " + String::toHexString ((int) getVirtualChecksum()) + ")"
+                                       : String())
+         + ", dropped notes " + String (droppedNotes + MidiOutManager::getSharedInstance().getNumDroppedNotes())
+         + ", dropped frames " + String (renderPipeline.getNumDroppedSnapshots()) + "/" + String (renderPipeline.getNumDroppedFrames())
+         + (midiLatency != nullptr ? " | " + MidiLatencyMonitor::toString (midiLatency->getReport()) : String())
+         + " | " + formatLatency ("simulate", RenderPipeline::Stage_Simulate)
+         + ", " + formatLatency ("compose", RenderPipeline::Stage_Compose)
+         + ", " + formatLatency ("transmit", RenderPipeline::Stage_Transmit)
+         + ", end-to-end " + String (renderPipeline.getLatency (RenderPipeline::Stage_EndToEnd).average, 2) + "ms";
+}
@@ -0,0 +1,147 @@
+//
+//  HeadlessEngine.h
+//  Bound - App
+//
+//  GUIなしでゲームを動かす。ボード、クロック、MIDI、LEDのパイプラインと、
+//  つなぐならBLOCKSのトポロジーも持つ。ラックのLinuxマシンで動かしたり、ウィンドウなしでプロファイルするため。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "BoardWorld.h"
+#include "MidiRouting.h"
+#include "SimulationClock.h"
+#include "RenderPipeline.h"
+#include "LEDRenderer.h"
+#include "BlockLayout.h"
+#include "VirtualTopology.h"
+#include "MidiLatencyMonitor.h"
+
+class HeadlessEngine : public TopologySource::Listener,
+                       private TouchSurface::Listener,
+                       private ControlButton::Listener,
+                       private VirtualTopologySource::Listener,
+                       private SimulationClock::Listener,
+                       private Timer
+{
+public:
+    struct Options
+    {
+        int numBoards = 2;       // boardColumns枚ずつ並べて上下左右をつなぐ。行が埋まるように切り上げる
+        int boardColumns = 1;
+        int numThreads = 0;      // ボードを進めるのと残像の合成に使うスレッドの数。0ならCPUの数
+        int numBalls = 0;        // 最初に置くボール。ボードに順に配る
+        double bpm = 0;          // 0ならDEFAULT_TICK_INTERVAL_MS
+        File routingFile = MidiRouting::getDefaultFile(); // 存在しなければデフォルトの配線
+        MidiBackendType midiBackend = MidiBackend_Device; // 配線のデバイスを全部これで開く
+        bool measureMidiLatency = false; // キャプチャを有効にして衝突からの遅れを測る
+        bool useBlocks = false;  // PhysicalTopologySourceをつなぐ
+        bool ballCollisions = false; // ボール同士をぶつける
+        int64 seed = 1;
+
+        // 仮想のLightpad。ボードが足りなければnumVirtualPadsまで増やす
+        int numVirtualPads = 0;
+        int virtualPadsPerRow = 8;
+        File scriptFile;                   // VirtualTopologySource::loadScriptの形式
+        double virtualFlicksPerSecond = 0; // パッドごとのランダムなフリック
+        double virtualScriptLengthMs = 60000;
+    };
+    
+    HeadlessEngine (const Options& options);
+    ~HeadlessEngine();
+    
+    void start();
+    void stop();
+    
+    /** startの代わりに、クロックもタイマーも使わずこのスレッドでnumTicksターン続けて進める。
+        台本はターンの時刻までのイベントをそのターンの前に送り、合成したフレームは捨てずに全部仮想のパッドに送るので、
+        同じOptionsならgetVirtualChecksumは毎回同じになる。実時間より速く回るので、MIDIはキャプチャにしておくこと */
+    void runTicks (int numTicks);
+    
+    /** Adds a ball at (x, y) on the given board, flung away from (fromX, fromY) */
+    void launchBall (int boardIndex, int x, int y, int fromX, int fromY);
+    
+    /** One line with tick, ball, MIDI and per-stage latency counters */
+    String getStatus();
+    
+    int getNumBoards() const    { return world->getNumBoards(); }
+    
+    /** nullptr unless the engine was created with numVirtualPads > 0 */
+    VirtualTopologySource* getVirtualTopology() const  { return virtualTopology; }
+    
+    /** 全部の仮想パッドのチェックサムをまとめたもの。runTicksで回したときだけ再現する
+        (startで回すとタッチはタイマー、フレームは間に合ったものだけなので、実行ごとに変わる) */
+    uint32 getVirtualChecksum() const;
+    
+    /** 開いたデバイスのうち、Options::midiBackendと違うバックエンドで開いているものの名前。
+        "virtual:"や"capture:"で名前に送り先を書いたものは入れない。--midi captureで実機に送っていないか確かめるため */
+    StringArray getMidiDevicesOnOtherBackends() const;
+    
+    /** nullptr unless measureMidiLatency was set */
+    MidiLatencyMonitor* getMidiLatency() const  { return midiLatency; }
+    
+    /** Overridden from TopologySource::Listener. Lightpads are given to the boards in the order they appear */
+    void topologyChanged() override;
+
+private:
+    void touchChanged (TouchSurface&, const TouchSurface::Touch&) override;
+    void buttonPressed (ControlButton&, Block::Timestamp) override {}
+    void buttonReleased (ControlButton&, Block::Timestamp) override;
+    
+    void virtualTopologyChanged() override;
+    void virtualTouchChanged (VirtualLightpad&, float x, float y, float z) override;
+    void virtualButtonReleased (VirtualLightpad&) override;
+    
+    void simulationTick (int64 tickIndex, double tickTimeMs) override;
+    
+    /** Delivers the script's touches and sends the newest composed frame */
+    void timerCallback() override;
+    
+    /** The transmit stage. Sends the newest composed frame to the blocks and the virtual pads */
+    void transmitFrame();
+    
+    void detachBlocks();
+    void clearTrails();
+    void addRandomBalls (int numBalls, int64 seed);
+    
+    // 実機のブロックでも仮想のパッドでも同じ
+    struct Attachment
+    {
+        Block::Ptr block;
+        VirtualLightpad* pad;
+        int boardIndex;
+        int rotation; // BlockLayout::Placement::rotation
+        float scaleX, scaleY;
+        bool isTap;
+        int fromX, fromY;
+    };
+    
+    Attachment* findAttachment (const Block&) const;
+    int getFreeBoardIndex() const; // ブロックのついていないボード。なければ-1
+    void detachBlock (Attachment&);
+    
+    /** 押したところから引っ張って離すと投げる(MainComponentと同じ) */
+    void handleTouch (Attachment& a, int x, int y, bool pressed);
+    
+    ScopedPointer<TaskScheduler> scheduler; // ボードを進めるのと残像の合成で共有する
+    ScopedPointer<game::BoardWorld> world;
+    CriticalSection boardLock; // ボードはクロックのスレッドからも触る
+    int64 numCollisions = 0;   // ボール同士がぶつかった回数。boardLockの中で触る
+    int numBallsLaunched = 0;  // 投げたボールの数。トラックを決める
+    MidiBackendType midiBackend = MidiBackend_Device; // Options::midiBackend
+    RenderPipeline renderPipeline;
+    LEDRenderer ledRenderer;
+    ScopedPointer<PhysicalTopologySource> topologySource;
+    OwnedArray<Attachment> attachedBlocks;
+    BlockLayout blockLayout;
+    ScopedPointer<VirtualTopologySource> virtualTopology;
+    OwnedArray<Attachment> attachedPads; // [パッドの番号]
+    double startTime = 0;
+    int64 numTicksRun = 0; // runTicksで進めたターン
+    ScopedPointer<MidiLatencyMonitor> midiLatency; // 読むのはメッセージスレッド
+    SimulationClock simulationClock { *this };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HeadlessEngine)
+};
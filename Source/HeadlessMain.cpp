@@ -0,0 +1,295 @@
+//
+//  HeadlessMain.cpp
+//  Bound - App
+//
+//  ヘッドレスのビルド(BOUND_HEADLESS=1)のmain。ウィンドウは作らずにメッセージループだけ回す。
+//  TimerとBLOCKSのトポロジーはメッセージスレッドで動くので、ループは要る。
+//  ビルドはHeadless/BoundHeadless.jucer(コンソールアプリ。juce_core、events、audio_basics、audio_devices、blocks_basicsだけ)。
+//  cd Headless/Builds/LinuxMakefile && make CONFIG=Release
+//  Debugの構成はBOUND_COUNT_ALLOCATIONS=1なので--check-allocationsが使える。
+//
+//  Bound --boards 4 --balls 200 --bpm 120 --seconds 30 --report 5
+//  Bound --boards 8 --columns 4 --balls 200000 --benchmark 200   (スレッドの数ごとの1ターンの時間)
+//  Bound --benchmark-collisions 50   (ボール同士の衝突の1ターンの時間)
+//  Bound --virtual 4 --flicks 2 --balls 100 --check-reproducible 500   (同じ台本を2回回してチェックサムを比べる)
+//  Bound --boards 8 --columns 4 --balls 20000 --check-determinism 100   (スレッドの数を変えても同じ盤面になるか)
+//
+
+#include "JuceHeader.h"
+
+#if BOUND_HEADLESS
+
+#include "HeadlessEngine.h"
+#include <csignal>
+#include <iostream>
+
+static volatile std::sig_atomic_t quitRequested = 0;
+
+static void requestQuit (int)
+{
+    quitRequested = 1;
+}
+
+/** Prints the engine status now and then, and leaves the dispatch loop on Ctrl-C or when the time is up */
+class HeadlessRunner : private Timer
+{
+public:
+    HeadlessRunner (HeadlessEngine& e, double seconds, double reportSeconds)
+        : engine (e),
+          endTime (seconds > 0 ? Time::getMillisecondCounterHiRes() + seconds * 1000.0 : 0),
+          reportInterval (reportSeconds * 1000.0)
+    {
+        nextReport = Time::getMillisecondCounterHiRes() + reportInterval;
+        startTimer (100);
+    }
+
+private:
+    void timerCallback() override
+    {
+        const double now = Time::getMillisecondCounterHiRes();
+
+        if (reportInterval > 0 && now >= nextReport)
+        {
+            std::cout << engine.getStatus() << std::endl;
+            nextReport += reportInterval;
+        }
+
+        if (quitRequested || (endTime > 0 && now >= endTime))
+        {
+            stopTimer();
+            MessageManager::getInstance()->stopDispatchLoop();
+        }
+    }
+
+    HeadlessEngine& engine;
+    const double endTime, reportInterval;
+    double nextReport;
+};
+
+/** --midi captureやvirtualで、配線したデバイスがほかのバックエンド(実機など)で開かれていたら止める */
+static bool checkMidiBackends (const HeadlessEngine& engine)
+{
+    const StringArray names = engine.getMidiDevicesOnOtherBackends();
+
+    if (names.size() == 0)
+        return true;
+
+    std::cout << "midi: " << names.joinIntoString (", ") << " not opened with the requested backend" << std::endl;
+    return false;
+}
+
+static void printUsage()
+{
+    std::cout << "usage: Bound [options]" << std::endl
+              << "  --boards N      number of boards (1 - " << MAX_RENDER_BOARDS << ", default 2)" << std::endl
+              << "  --columns N     boards per row; the rows are filled up and neighbours connected (default 1)" << std::endl
+              << "  --threads N     threads that step the boards and compose the LEDs (default: one per core)" << std::endl
+              << "  --balls N       balls to start with, spread over the boards (default 0)" << std::endl
+              << "  --seed N        random seed for the starting balls (default 1)" << std::endl
+              << "  --bpm BPM       tempo, 4 ticks per beat" << std::endl
+              << "  --routing FILE  MIDI routing json (default " << MidiRouting::getDefaultFile().getFullPathName() << ")" << std::endl
+              << "  --midi TYPE     open the routed MIDI devices as device (default), virtual (ALSA/CoreMIDI port) or capture" << std::endl
+              << "  --midi-latency  measure collision-to-message delay and jitter (always on with --midi capture)" << std::endl
+              << "  --collisions    balls bounce off each other and play their notes" << std::endl
+              << "                  (fits the default tick up to about 10000 fast balls per board, see --benchmark-collisions)" << std::endl
+              << "  --blocks        attach connected Lightpads to the boards" << std::endl
+              << "  --virtual N     add N virtual Lightpads, one per board (adds boards if needed)" << std::endl
+              << "  --per-row N     virtual Lightpads per row (default 8)" << std::endl
+              << "  --script FILE   touch and button script for the virtual Lightpads" << std::endl
+              << "  --flicks R      random flicks per virtual Lightpad per second" << std::endl
+              << "  --seconds S     quit after S seconds (default: run until Ctrl-C)" << std::endl
+              << "  --report S      print the status every S seconds (default 1, 0 = only at exit)" << std::endl
+              << "  --benchmark T   time T ticks with 1 up to --threads threads, 3/4 of --balls on the first board, and quit" << std::endl
+              << "  --benchmark-collisions T" << std::endl
+              << "                  time T ticks of ball-ball collisions from 10 to 50000 balls on one " << CANVAS_SIZE << "x" << CANVAS_SIZE << " board, and quit" << std::endl
+              << "  --deterministic T" << std::endl
+              << "                  run T ticks back to back: script by tick time, every frame to the virtual pads," << std::endl
+              << "                  MIDI captured only; prints the status with the checksum and quits" << std::endl
+              << "  --check-reproducible T" << std::endl
+              << "                  do --deterministic T twice and exit 1 if the checksums differ" << std::endl
+              << "  --check-determinism T" << std::endl
+              << "                  step the boards T ticks with 1 up to --threads threads and exit 1 if the boards differ" << std::endl
+              << "                  (once with Lightpad-sized boards, once with " << CANVAS_SIZE << "x" << CANVAS_SIZE << " canvas boards)" << std::endl
+              << "  --check-allocations T" << std::endl
+              << "                  step fixed-capacity boards for T ticks and exit 1 if anything allocated" << std::endl
+              << "                  (needs a build with BOUND_COUNT_ALLOCATIONS=1)" << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+    StringArray args;
+    for (int i = 1; i < argc; i++)
+        args.add (argv[i]);
+
+    HeadlessEngine::Options options;
+    double seconds = 0, reportSeconds = 1.0;
+    int benchmarkTicks = 0;
+    int collisionBenchmarkTicks = 0;
+    int allocationCheckTicks = 0;
+    int determinismCheckTicks = 0;
+    int deterministicTicks = 0;
+    int reproducibilityCheckTicks = 0;
+
+    for (int i = 0; i < args.size(); i++)
+    {
+        const String& arg = args[i];
+        const String value = args[i + 1]; // 範囲外なら空
+
+        if      (arg == "--boards")   { options.numBoards = value.getIntValue(); i++; }
+        else if (arg == "--columns")  { options.boardColumns = value.getIntValue(); i++; }
+        else if (arg == "--threads")  { options.numThreads = value.getIntValue(); i++; }
+        else if (arg == "--balls")    { options.numBalls = value.getIntValue(); i++; }
+        else if (arg == "--seed")     { options.seed = value.getLargeIntValue(); i++; }
+        else if (arg == "--bpm")      { options.bpm = value.getDoubleValue(); i++; }
+        else if (arg == "--routing")  { options.routingFile = File::getCurrentWorkingDirectory().getChildFile (value); i++; }
+        else if (arg == "--midi")
+        {
+            options.midiBackend = value == "virtual" ? MidiBackend_VirtualPort
+                                : value == "capture" ? MidiBackend_Capture
+                                                     : MidiBackend_Device;
+            options.measureMidiLatency |= options.midiBackend == MidiBackend_Capture;
+            i++;
+        }
+        else if (arg == "--midi-latency") { options.measureMidiLatency = true; }
+        else if (arg == "--collisions") { options.ballCollisions = true; }
+        else if (arg == "--blocks")   { options.useBlocks = true; }
+        else if (arg == "--virtual")  { options.numVirtualPads = value.getIntValue(); i++; }
+        else if (arg == "--per-row")  { options.virtualPadsPerRow = value.getIntValue(); i++; }
+        else if (arg == "--script")   { options.scriptFile = File::getCurrentWorkingDirectory().getChildFile (value); i++; }
+        else if (arg == "--flicks")   { options.virtualFlicksPerSecond = value.getDoubleValue(); i++; }
+        else if (arg == "--seconds")  { seconds = value.getDoubleValue(); i++; }
+        else if (arg == "--report")   { reportSeconds = value.getDoubleValue(); i++; }
+        else if (arg == "--benchmark") { benchmarkTicks = value.getIntValue(); i++; }
+        else if (arg == "--benchmark-collisions") { collisionBenchmarkTicks = value.getIntValue(); i++; }
+        else if (arg == "--check-allocations") { allocationCheckTicks = value.getIntValue(); i++; }
+        else if (arg == "--check-determinism") { determinismCheckTicks = value.getIntValue(); i++; }
+        else if (arg == "--deterministic") { deterministicTicks = value.getIntValue(); i++; }
+        else if (arg == "--check-reproducible") { reproducibilityCheckTicks = value.getIntValue(); i++; }
+        else
+        {
+            printUsage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    if (seconds > 0)
+        options.virtualScriptLengthMs = seconds * 1000.0;
+
+    // ボードを進めるところだけ測る。音もLEDも出さない
+    if (benchmarkTicks > 0)
+    {
+        const int columns = jmax (1, options.boardColumns);
+        const int rows = jmax (1, (options.numBoards + columns - 1) / columns);
+
+        std::cout << game::BoardWorld::benchmarkScaling (columns, rows, options.numBalls > 0 ? options.numBalls : 100000,
+                                                         benchmarkTicks, options.numThreads);
+        return 0;
+    }
+
+    if (collisionBenchmarkTicks > 0)
+    {
+        std::cout << game::CanvasBoardWorld::benchmarkCollisions (collisionBenchmarkTicks);
+        return 0;
+    }
+
+    // スレッドの数と範囲の分け方を変えて進め、1スレッドのときと盤面が違えば失敗にする
+    if (determinismCheckTicks > 0)
+    {
+        const int columns = jmax (1, options.boardColumns);
+        const int rows = jmax (1, (options.numBoards + columns - 1) / columns);
+        const int numBalls = options.numBalls > 0 ? options.numBalls : 20000;
+
+        // Lightpad 1枚ずつのものと、64x64の盤面を並べたもの
+        const bool same = game::BoardWorld::checkDeterminism (columns, rows, numBalls, determinismCheckTicks, options.numThreads);
+        const bool canvasSame = game::CanvasBoardWorld::checkDeterminism (columns, rows, numBalls, determinismCheckTicks, options.numThreads);
+
+        std::cout << "determinism check: " << (same ? "same" : "DIFFERENT") << " boards after " << determinismCheckTicks << " ticks" << std::endl
+                  << "determinism check (canvas " << CANVAS_SIZE << "x" << CANVAS_SIZE << "): " << (canvasSame ? "same" : "DIFFERENT")
+                  << " boards after " << determinismCheckTicks << " ticks" << std::endl;
+        return same && canvasSame ? 0 : 1;
+    }
+
+    // 固定容量のボードを進めて、1回でも確保したら失敗にする
+    if (allocationCheckTicks > 0)
+    {
+        const int columns = jmax (1, options.boardColumns);
+        const int rows = jmax (1, (options.numBoards + columns - 1) / columns);
+        const int64 numAllocations = game::BoardWorld::checkAllocations (columns, rows, options.numBalls > 0 ? options.numBalls : 2000,
+                                                                         allocationCheckTicks, options.numThreads);
+
+        if (numAllocations < 0)
+        {
+            std::cout << "allocation check: not available, build with BOUND_COUNT_ALLOCATIONS=1" << std::endl;
+            return 2;
+        }
+
+        std::cout << "allocation check: " << numAllocations << " allocations in " << allocationCheckTicks << " ticks" << std::endl;
+        return numAllocations == 0 ? 0 : 1;
+    }
+
+    // juce_eventsのもの。MessageManagerを作るだけで、ディスプレイにはつながない
+    // 台本もフレームもターンで回す。実時間より速く回るので音は出さず、実機のブロックもつながない
+    if (deterministicTicks > 0 || reproducibilityCheckTicks > 0)
+    {
+        const int numTicks = jmax (deterministicTicks, reproducibilityCheckTicks);
+
+        options.midiBackend = MidiBackend_Capture;
+        options.useBlocks = false;
+        options.numVirtualPads = jmax (1, options.numVirtualPads);
+
+        if (seconds <= 0)
+            options.virtualScriptLengthMs = numTicks * (options.bpm > 0 ? 60000.0 / (options.bpm * DEFAULT_TICKS_PER_BEAT)
+                                                                        : DEFAULT_TICK_INTERVAL_MS);
+
+        ScopedJuceInitialiser_GUI juceInitialiser;
+
+        bool backendsMatch = true;
+
+        auto run = [&options, numTicks, &backendsMatch]
+        {
+            ScopedPointer<HeadlessEngine> engine (new HeadlessEngine (options));
+            backendsMatch = backendsMatch && checkMidiBackends (*engine);
+            engine->runTicks (numTicks);
+            std::cout << engine->getStatus() << std::endl;
+            return engine->getVirtualChecksum();
+        };
+
+        const uint32 checksum = run();
+
+        if (! backendsMatch)
+            return 1;
+
+        if (reproducibilityCheckTicks <= 0)
+            return 0;
+
+        const uint32 again = run();
+        std::cout << "reproducibility check: " << (checksum == again ? "same" : "different") << " checksum ("
+                  << String::toHexString ((int) checksum) << ", " << String::toHexString ((int) again) << ")" << std::endl;
+        return checksum == again && backendsMatch ? 0 : 1;
+    }
+
+    ScopedJuceInitialiser_GUI juceInitialiser;
+
+    std::signal (SIGINT, requestQuit);
+    std::signal (SIGTERM, requestQuit);
+
+    {
+        // ボードが多いとパイプラインのバッファが大きいので、スタックには置かない
+        ScopedPointer<HeadlessEngine> engine (new HeadlessEngine (options));
+
+        if (! checkMidiBackends (*engine))
+            return 1;
+
+        HeadlessRunner runner (*engine, seconds, reportSeconds);
+
+        engine->start();
+        MessageManager::getInstance()->runDispatchLoop();
+        engine->stop();
+
+        std::cout << engine->getStatus() << std::endl;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,190 @@
+//
+//  LEDFrameBuffer.cpp
+//  Bound - App
+//
+
+#include "LEDFrameBuffer.h"
+#include <cstring>
+
+#if defined (__AVX2__)
+ #include <immintrin.h>
+ #define BOUND_LED_USE_AVX2 1
+#elif defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define BOUND_LED_USE_SSE 1
+#endif
+
+using namespace game;
+
+LEDFrameBuffer::LEDFrameBuffer()
+{
+    setDecay(LEDDECAY);
+    clear();
+
+    std::memset(ballRed, 0, sizeof(ballRed));
+    std::memset(ballGreen, 0, sizeof(ballGreen));
+    std::memset(ballBlue, 0, sizeof(ballBlue));
+}
+
+void LEDFrameBuffer::clear()
+{
+    std::memset(red, 0, sizeof(red));
+    std::memset(green, 0, sizeof(green));
+    std::memset(blue, 0, sizeof(blue));
+    std::memset(rgb565, 0, sizeof(rgb565));
+}
+
+void LEDFrameBuffer::setDecay(double decay)
+{
+    decay = decay < 0 ? 0 : (decay > 1 ? 1 : decay);
+    decayFactor = (uint16_t) (decay * 0xffff);
+}
+
+// 0 - 255のfloatを8.8にする
+static inline uint16_t toFixed(float c)
+{
+    c = c < 0.f ? 0.f : (c > 255.f ? 255.f : c);
+    return (uint16_t) (c * 256.f);
+}
+
+void LEDFrameBuffer::splat(int x, int y, uint16_t r, uint16_t g, uint16_t b, bool isBallCell)
+{
+    if (x < 0 || x >= BLOCKS_SIZE || y < 0 || y >= BLOCKS_SIZE) return;
+
+    const int i = x * BLOCKS_SIZE + y;
+    ballRed[i] = r;
+    ballGreen[i] = g;
+    ballBlue[i] = b;
+    splatMask[i] = 0xffff;
+    if (isBallCell) ballMask[i] = 0xffff;
+}
+
+void LEDFrameBuffer::compose(const BoardFrame &frame)
+{
+    std::memset(ballMask, 0, sizeof(ballMask));
+    std::memset(splatMask, 0, sizeof(splatMask));
+
+    // ボールのマスを平面に集める。ボールは少ないのでここは普通のループ
+    for (int x = 0; x < BLOCKS_SIZE; x++)
+    {
+        for (int y = 0; y < BLOCKS_SIZE; y++)
+        {
+            const BoardState &state = frame[x][y];
+            if (state.c != Charactor_Ball) continue;
+
+            const uint16_t r = toFixed(state.r), g = toFixed(state.g), b = toFixed(state.b);
+
+            // 壁際のボールは壁にもにじませる(壁ピンク化)。盤面の外には書かない
+            if (x <= 1)
+            {
+                splat(x - 1, y, r, g, b, false);
+                splat(x - 1, y + 1, r, g, b, false);
+                splat(x - 1, y - 1, r, g, b, false);
+            }
+            if (x >= BLOCKS_SIZE - 2)
+            {
+                splat(x + 1, y, r, g, b, false);
+                splat(x + 1, y + 1, r, g, b, false);
+                splat(x + 1, y - 1, r, g, b, false);
+            }
+            if (y <= 1)
+            {
+                splat(x, y - 1, r, g, b, false);
+                splat(x + 1, y - 1, r, g, b, false);
+                splat(x - 1, y - 1, r, g, b, false);
+            }
+            if (y >= BLOCKS_SIZE - 2)
+            {
+                splat(x, y + 1, r, g, b, false);
+                splat(x + 1, y + 1, r, g, b, false);
+                splat(x - 1, y + 1, r, g, b, false);
+            }
+        }
+    }
+
+    // ボールのマスはにじみより優先
+    for (int x = 0; x < BLOCKS_SIZE; x++)
+    {
+        for (int y = 0; y < BLOCKS_SIZE; y++)
+        {
+            const BoardState &state = frame[x][y];
+            if (state.c == Charactor_Ball)
+                splat(x, y, toFixed(state.r), toFixed(state.g), toFixed(state.b), true);
+        }
+    }
+
+    int i = 0;
+
+#if BOUND_LED_USE_AVX2
+    const __m256i factor = _mm256_set1_epi16((short) decayFactor);
+    const __m256i redMask = _mm256_set1_epi16((short) 0xf800);
+
+    #define BOUND_BLEND(a, b, m) _mm256_or_si256(_mm256_andnot_si256(m, a), _mm256_and_si256(m, b))
+    #define BOUND_LOAD(p) _mm256_loadu_si256((const __m256i*) ((p) + i))
+    #define BOUND_STORE(p, v) _mm256_storeu_si256((__m256i*) ((p) + i), v)
+
+    for (; i + 16 <= planeSize; i += 16)
+    {
+        const __m256i r = BOUND_LOAD(red), g = BOUND_LOAD(green), b = BOUND_LOAD(blue);
+        const __m256i br = BOUND_LOAD(ballRed), bg = BOUND_LOAD(ballGreen), bb = BOUND_LOAD(ballBlue);
+        const __m256i cell = BOUND_LOAD(ballMask), splatted = BOUND_LOAD(splatMask);
+
+        // 送る色。上位ビットを取るだけなので0xff00を超えることはない
+        const __m256i sr = BOUND_BLEND(r, br, cell), sg = BOUND_BLEND(g, bg, cell), sb = BOUND_BLEND(b, bb, cell);
+        BOUND_STORE(rgb565, _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(sr, redMask),
+                                                            _mm256_slli_epi16(_mm256_srli_epi16(sg, 10), 5)),
+                                            _mm256_srli_epi16(sb, 11)));
+
+        // 減衰してからボールを書く
+        BOUND_STORE(red, BOUND_BLEND(_mm256_mulhi_epu16(r, factor), br, splatted));
+        BOUND_STORE(green, BOUND_BLEND(_mm256_mulhi_epu16(g, factor), bg, splatted));
+        BOUND_STORE(blue, BOUND_BLEND(_mm256_mulhi_epu16(b, factor), bb, splatted));
+    }
+
+    #undef BOUND_BLEND
+    #undef BOUND_LOAD
+    #undef BOUND_STORE
+#elif BOUND_LED_USE_SSE
+    const __m128i factor = _mm_set1_epi16((short) decayFactor);
+    const __m128i redMask = _mm_set1_epi16((short) 0xf800);
+
+    #define BOUND_BLEND(a, b, m) _mm_or_si128(_mm_andnot_si128(m, a), _mm_and_si128(m, b))
+    #define BOUND_LOAD(p) _mm_loadu_si128((const __m128i*) ((p) + i))
+    #define BOUND_STORE(p, v) _mm_storeu_si128((__m128i*) ((p) + i), v)
+
+    for (; i + 8 <= planeSize; i += 8)
+    {
+        const __m128i r = BOUND_LOAD(red), g = BOUND_LOAD(green), b = BOUND_LOAD(blue);
+        const __m128i br = BOUND_LOAD(ballRed), bg = BOUND_LOAD(ballGreen), bb = BOUND_LOAD(ballBlue);
+        const __m128i cell = BOUND_LOAD(ballMask), splatted = BOUND_LOAD(splatMask);
+
+        const __m128i sr = BOUND_BLEND(r, br, cell), sg = BOUND_BLEND(g, bg, cell), sb = BOUND_BLEND(b, bb, cell);
+        BOUND_STORE(rgb565, _mm_or_si128(_mm_or_si128(_mm_and_si128(sr, redMask),
+                                                      _mm_slli_epi16(_mm_srli_epi16(sg, 10), 5)),
+                                         _mm_srli_epi16(sb, 11)));
+
+        BOUND_STORE(red, BOUND_BLEND(_mm_mulhi_epu16(r, factor), br, splatted));
+        BOUND_STORE(green, BOUND_BLEND(_mm_mulhi_epu16(g, factor), bg, splatted));
+        BOUND_STORE(blue, BOUND_BLEND(_mm_mulhi_epu16(b, factor), bb, splatted));
+    }
+
+    #undef BOUND_BLEND
+    #undef BOUND_LOAD
+    #undef BOUND_STORE
+#endif
+
+    // SIMDがないとき。やっていることは上と同じ
+    for (; i < planeSize; i++)
+    {
+        const bool cell = ballMask[i] != 0, splatted = splatMask[i] != 0;
+
+        const uint16_t sr = cell ? ballRed[i] : red[i];
+        const uint16_t sg = cell ? ballGreen[i] : green[i];
+        const uint16_t sb = cell ? ballBlue[i] : blue[i];
+        rgb565[i] = (uint16_t) ((sr & 0xf800) | ((sg >> 10) << 5) | (sb >> 11));
+
+        red[i]   = splatted ? ballRed[i]   : (uint16_t) ((red[i]   * (uint32_t) decayFactor) >> 16);
+        green[i] = splatted ? ballGreen[i] : (uint16_t) ((green[i] * (uint32_t) decayFactor) >> 16);
+        blue[i]  = splatted ? ballBlue[i]  : (uint16_t) ((blue[i]  * (uint32_t) decayFactor) >> 16);
+    }
+}
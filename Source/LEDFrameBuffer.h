@@ -0,0 +1,65 @@
+//
+//  LEDFrameBuffer.h
+//  Bound - App
+//
+//  LEDの残像を持つフレームバッファ。
+//  色ごとに16bit(8.8の固定小数点)の平面を詰めて持ち、減衰とボールの書き込みをSIMDでまとめてやる。
+//  送る色はデバイスと同じRGB565で作っておくので、LEDTransportも画面のミラーもそれをそのまま読む。
+//
+
+#pragma once
+
+#include <cstdint>
+#include "Game.h"
+
+NAMESPACE_GAME_BEGIN
+
+class LEDFrameBuffer
+{
+public:
+    enum
+    {
+        numPixels = BLOCKS_SIZE * BLOCKS_SIZE,
+        planeSize = (numPixels + 15) & ~15 // 16の倍数に切り上げる。端数の処理をしなくていいように
+    };
+
+    LEDFrameBuffer();
+
+    void clear();
+
+    // 1フレームごとに残像に掛ける値(0 - 1)
+    void setDecay(double decay);
+
+    // 1フレーム進める。今の残像にボールのマスを重ねたものをRGB565にして、
+    // そのあと残像を減衰させてボール(と壁際のにじみ)を書き込む
+    void compose(const BoardFrame &frame);
+
+    // [x * BLOCKS_SIZE + y]で引く。コピーせずにそのまま送る・描く
+    const uint16_t* getRGB565() const { return rgb565; }
+    uint16_t getRGB565(int x, int y) const { return rgb565[x * BLOCKS_SIZE + y]; }
+
+    // RGB565を8bitに戻す。もう一度RGB565にすると同じ値になる
+    static void unpackRGB565(uint16_t p, uint8_t &r, uint8_t &g, uint8_t &b)
+    {
+        const int r5 = (p >> 11) & 0x1f, g6 = (p >> 5) & 0x3f, b5 = p & 0x1f;
+        r = (uint8_t) ((r5 << 3) | (r5 >> 2));
+        g = (uint8_t) ((g6 << 2) | (g6 >> 4));
+        b = (uint8_t) ((b5 << 3) | (b5 >> 2));
+    }
+
+private:
+    void splat(int x, int y, uint16_t r, uint16_t g, uint16_t b, bool isBallCell);
+
+    // 8.8の固定小数点。0xff00が最大
+    uint16_t red[planeSize], green[planeSize], blue[planeSize];
+
+    // composeの作業用。そのフレームのボールの色と、どこに書くか(0xffffか0)
+    uint16_t ballRed[planeSize], ballGreen[planeSize], ballBlue[planeSize];
+    uint16_t ballMask[planeSize];  // ボールのマス。送る色にも重ねる
+    uint16_t splatMask[planeSize]; // 残像に書くマス
+
+    uint16_t rgb565[planeSize];
+    uint16_t decayFactor; // 0x10000倍したもの
+};
+
+NAMESPACE_GAME_END
@@ -0,0 +1,130 @@
+//
+//  LEDRenderer.cpp
+//  Bound - App
+//
+
+#include "LEDRenderer.h"
+
+using namespace game;
+
+void LEDRenderer::clear()
+{
+    targets.clear();
+    pixelsWrittenLastFrame = 0;
+}
+
+LEDRenderer::Target* LEDRenderer::findTarget (const Block& block) const
+{
+    for (auto* t : targets)
+        if (t->block.get() == &block)
+            return t;
+
+    return nullptr;
+}
+
+void LEDRenderer::addBlock (Block::Ptr block, int boardIndex, int rotation)
+{
+    if (block == nullptr || ! isPositiveAndBelow (boardIndex, MAX_RENDER_BOARDS))
+        return;
+
+    if (auto* existing = findTarget (*block))
+    {
+        if (existing->boardIndex != boardIndex || existing->rotation != rotation)
+        {
+            existing->boardIndex = boardIndex;
+            existing->rotation = rotation;
+            existing->transport.invalidate();
+        }
+
+        return;
+    }
+
+    auto* t = new Target();
+    t->block = block;
+    t->boardIndex = boardIndex;
+    t->rotation = rotation;
+    targets.add (t);
+}
+
+void LEDRenderer::removeBlock (Block& block)
+{
+    if (auto* t = findTarget (block))
+        targets.removeObject (t);
+}
+
+void LEDRenderer::invalidate (Block& block)
+{
+    if (auto* t = findTarget (block))
+        t->transport.invalidate();
+}
+
+void LEDRenderer::render (const ComposedFrame& frame)
+{
+    int written = 0;
+
+    for (auto* t : targets)
+    {
+        if (t->boardIndex >= frame.numBoards)
+            continue;
+
+        auto* program = t->block->getProgram();
+
+        if (auto* trailProgram = dynamic_cast<BallTrailProgram*> (program))
+        {
+            trailProgram->setFrame (t->rotation == 0 ? frame.frames[t->boardIndex] : rotateFrame (frame.frames[t->boardIndex], t->rotation));
+            written += trailProgram->getNumBallsSent();
+        }
+        else if (auto* canvasProgram = dynamic_cast<BitmapLEDProgram*> (program))
+        {
+            written += t->transport.flush (*canvasProgram, t->rotation == 0 ? frame.rgb565[t->boardIndex]
+                                                                            : rotatePixels (frame.rgb565[t->boardIndex], t->rotation));
+        }
+    }
+
+    pixelsWrittenLastFrame = written;
+}
+
+const BoardFrame& LEDRenderer::rotateFrame (const BoardFrame& frame, int rotation)
+{
+    for (int x = 0; x < BLOCKS_SIZE; x++)
+    {
+        for (int y = 0; y < BLOCKS_SIZE; y++)
+        {
+            int boardX, boardY;
+            BlockLayout::blockToBoard (rotation, x, y, boardX, boardY);
+            rotatedFrame[x][y] = frame[boardX][boardY];
+        }
+    }
+
+    return rotatedFrame;
+}
+
+const uint16* LEDRenderer::rotatePixels (const uint16* pixels, int rotation)
+{
+    for (int x = 0; x < BLOCKS_SIZE; x++)
+    {
+        for (int y = 0; y < BLOCKS_SIZE; y++)
+        {
+            int boardX, boardY;
+            BlockLayout::blockToBoard (rotation, x, y, boardX, boardY);
+            rotatedPixels[x * BLOCKS_SIZE + y] = pixels[boardX * BLOCKS_SIZE + boardY];
+        }
+    }
+
+    return rotatedPixels;
+}
+
+void LEDRenderer::clearLEDs()
+{
+    static const uint16 black[LEDFrameBuffer::planeSize] = {};
+
+    for (auto* t : targets)
+    {
+        auto* program = t->block->getProgram();
+
+        if (auto* trailProgram = dynamic_cast<BallTrailProgram*> (program))
+            trailProgram->clear();
+        else if (auto* canvasProgram = dynamic_cast<BitmapLEDProgram*> (program))
+            t->transport.flush (*canvasProgram, black);
+    }
+}
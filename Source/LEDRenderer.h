@@ -0,0 +1,68 @@
+//
+//  LEDRenderer.h
+//  Bound - App
+//
+//  つながっているLightpadごとに、RenderPipelineが合成したそれぞれのボードのフレームを送る(transmitの段)。
+//  1フレームぶんを全部のブロックに続けて送る。ブロックを増やしてもコストはマスの数に比例するだけ。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "LEDTransport.h"
+#include "RenderPipeline.h"
+#include "BallTrailProgram.h"
+#include "BlockLayout.h"
+
+class LEDRenderer
+{
+public:
+    LEDRenderer() {}
+
+    /** 全部のブロックを外す */
+    void clear();
+
+    /** blockにboardIndex番目のボードを描く。同じブロックをもう一度渡したらボードと向きだけ入れ替える。
+        rotationはBlockLayoutと同じ(ブロックの上が盤面のどちらを向いているか) */
+    void addBlock (Block::Ptr block, int boardIndex, int rotation = 0);
+
+    /** blockを外す。ほかのブロックはそのまま */
+    void removeBlock (Block& block);
+
+    int getNumBlocks() const  { return targets.size(); }
+
+    /** blockのプログラムを入れ替えたときに呼ぶ。次のrenderで全部送る */
+    void invalidate (Block& block);
+
+    /** frameを全部のブロックに送る */
+    void render (const ComposedFrame& frame);
+
+    /** 全部のブロックを消す */
+    void clearLEDs();
+
+    /** 前のrenderで全部のブロックに書いたマスの数(BallTrailProgramのブロックはボールのマスの数) */
+    int getPixelsWrittenLastFrame() const  { return pixelsWrittenLastFrame; }
+
+private:
+    struct Target
+    {
+        Block::Ptr block;
+        int boardIndex;
+        int rotation;
+        LEDTransport transport;
+    };
+
+    Target* findTarget (const Block& block) const;
+
+    /** ブロックのマス(x, y)に盤面のどのマスを出すか並べ替える。返すのは作業用のバッファ */
+    const game::BoardFrame& rotateFrame (const game::BoardFrame& frame, int rotation);
+    const uint16* rotatePixels (const uint16* pixels, int rotation);
+
+    OwnedArray<Target> targets;
+    game::BoardFrame rotatedFrame; // 回したブロックに送るときの作業用
+    uint16 rotatedPixels[game::LEDFrameBuffer::planeSize];
+    int pixelsWrittenLastFrame = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LEDRenderer)
+};
@@ -0,0 +1,78 @@
+//
+//  LEDTransport.h
+//  Bound - App
+//
+//  BitmapLEDProgramへの書き込みを差分だけにする。
+//  BLOCKSはシリアルの帯域が狭いので、毎フレーム225マス全部送るとフレームレートが落ちて遅れも増える。
+//  ブロックごとに最後に送った色を覚えておき、変わったマスだけsetLEDする。
+//  色はLEDFrameBufferが作ったRGB565(デバイスが持っている形)で比べるので、見た目が変わらない違いは送らない。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "LEDFrameBuffer.h"
+
+class LEDTransport
+{
+public:
+    LEDTransport()
+    {
+        invalidate();
+    }
+    
+    /** 次のflushで全部のマスを送る。プログラムを入れ替えたとき(デバイス側の中身がわからないとき)に呼ぶ */
+    void invalidate()
+    {
+        sentValid = false;
+    }
+    
+    /** pixels(RGB565、[x * BLOCKS_SIZE + y])のうち、前に送ったものと違うマスだけprogramに書く。書いたマスの数を返す */
+    int flush(BitmapLEDProgram &program, const uint16 *pixels)
+    {
+        int written = 0;
+        
+        for (int x = 0; x < BLOCKS_SIZE; x++)
+        {
+            for (int y = 0; y < BLOCKS_SIZE; y++)
+            {
+                const uint16 p = pixels[x * BLOCKS_SIZE + y];
+                if (sentValid && sent[x][y] == p) continue;
+                
+                uint8 r, g, b;
+                game::LEDFrameBuffer::unpackRGB565(p, r, g, b);
+                program.setLED((uint32) x, (uint32) y, LEDColour(0xff000000u | ((uint32) r << 16) | ((uint32) g << 8) | b));
+                sent[x][y] = p;
+                written++;
+            }
+        }
+        
+        sentValid = true;
+        pixelsWrittenLastFrame = written;
+        totalPixelsWritten += written;
+        numFrames++;
+        
+        return written;
+    }
+    
+    int getPixelsWrittenLastFrame() const { return pixelsWrittenLastFrame; }
+    int64 getTotalPixelsWritten() const   { return totalPixelsWritten; }
+    int64 getNumFrames() const            { return numFrames; }
+    
+    // 1フレームあたりの平均
+    double getAveragePixelsPerFrame() const
+    {
+        return numFrames > 0 ? (double) totalPixelsWritten / (double) numFrames : 0;
+    }
+    
+private:
+    uint16 sent[BLOCKS_SIZE][BLOCKS_SIZE]; // [x][y]。デバイスと同じRGB565
+    bool sentValid;
+    
+    int pixelsWrittenLastFrame = 0;
+    int64 totalPixelsWritten = 0;
+    int64 numFrames = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE(LEDTransport)
+};
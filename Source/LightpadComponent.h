@@ -26,6 +26,14 @@
 
 #pragma once
 
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include "LEDFrameBuffer.h"
+
+#define MIRROR_REFRESH_HZ 60 // ミラーを描きなおす最大の頻度。画面のリフレッシュレートに合わせる
+
 //==============================================================================
 /**
  Represents a single LED on a Lightpad
@@ -51,20 +59,31 @@ struct LEDComponent : public Component
 
 //==============================================================================
 /**
- A component that is used to represent a Lightpad on-screen
+ A component that is used to represent a Lightpad on-screen.
+ 
+ In mirror mode the LEDComponents are hidden and the whole grid, for one or more boards
+ side by side, is painted in a single paint() call from RGB565 frames. Updates are
+ coalesced so the component repaints at most once per display refresh.
  */
-class LightpadComponent : public Component
+class LightpadComponent : public Component,
+                          private Timer
 {
 public:
     LightpadComponent ()
     {
-        for (auto x = 0; x < 15; ++x)
-            for (auto y = 0; y < 15; ++y)
+        for (auto x = 0; x < gridWidth; ++x)
+            for (auto y = 0; y < gridHeight; ++y)
                 addAndMakeVisible (leds.add (new LEDComponent()));
     }
     
     void paint (Graphics& g) override
     {
+        if (mirrorMode)
+        {
+            paintMirror (g);
+            return;
+        }
+        
         auto r = getLocalBounds().toFloat();
         
         // Clip the drawing area to only draw in the block area
@@ -81,62 +100,132 @@ public:
     
     void resized() override
     {
-        auto r = getLocalBounds().reduced (10);
+        auto r = mirrorMode ? getBoardBounds (0).reduced (10) : getLocalBounds().reduced (10);
         
-        auto circleWidth = r.getWidth() / 15;
-        auto circleHeight = r.getHeight() / 15;
+        auto circleWidth = r.getWidth() / gridWidth;
+        auto circleHeight = r.getHeight() / gridHeight;
         
-        for (auto x = 0; x < 15; ++x)
-            for (auto y = 0; y < 15; ++y)
-                leds.getUnchecked ((x * 15) + y)->setBounds (r.getX() + (x * circleWidth),
-                                                             r.getY() + (y * circleHeight),
-                                                             circleWidth, circleHeight);
+        for (auto x = 0; x < gridWidth; ++x)
+            for (auto y = 0; y < gridHeight; ++y)
+                leds.getUnchecked ((x * gridHeight) + y)->setBounds (r.getX() + (x * circleWidth),
+                                                                     r.getY() + (y * circleHeight),
+                                                                     circleWidth, circleHeight);
     }
     
     void mouseDown (const MouseEvent& e) override
     {
-        for (auto x = 0; x < 15; ++x)
+        auto p = toCellSpace (e.position);
+        int x, y;
+        
+        lastCellPosition = p;
+        lastMouseEventTime = e.eventTime;
+        
+        if (getCell (p, x, y))
         {
-            for (auto y = 0; y < 15; ++y)
-            {
-                if (leds.getUnchecked ((x * 15) + y)->getBounds().contains (e.position.toInt()))
-                {
-                    listeners.call (&Listener::ledClicked, x, y, e.pressure);
-                }
-            }
+            lastLED = Point<int> (x, y);
+            listeners.call (&Listener::ledClicked, x, y, e.pressure);
+        }
+        else
+        {
+            lastLED = Point<int> (-1, -1);
         }
     }
     
     void mouseDrag (const MouseEvent& e) override
     {
-        for (auto x = 0; x < 15; ++x)
+        auto p = toCellSpace (e.position);
+        const auto t = e.eventTime;
+        bool movedToNewCell = false;
+        
+        // 速く動かしてイベントの間に飛ばしたマスも全部通ったことにする
+        forEachCellCrossed (lastCellPosition, p, [&] (int x, int y)
         {
-            for (auto y = 0; y < 15; ++y)
-            {
-                if (leds.getUnchecked ((x * 15) + y)->getBounds().contains (e.position.toInt()))
-                {
-                    const auto t = e.eventTime;
-                    
-                    if (lastLED == Point<int> (x, y) && t.toMilliseconds() - lastMouseEventTime.toMilliseconds() < 50)
-                        return;
-                    
-                    listeners.call (&Listener::ledClicked, x, y, e.pressure);
-                    
-                    lastLED = Point<int> (x, y);
-                    lastMouseEventTime = t;
-                }
-            }
+            if (! isPositiveAndBelow (x, (int) gridWidth) || ! isPositiveAndBelow (y, (int) gridHeight))
+                return;
+            
+            listeners.call (&Listener::ledClicked, x, y, e.pressure);
+            lastLED = Point<int> (x, y);
+            movedToNewCell = true;
+        });
+        
+        lastCellPosition = p;
+        
+        if (movedToNewCell)
+        {
+            lastMouseEventTime = t;
+            return;
         }
+        
+        // 同じマスに留まっているときは押しっぱなしとして50msごとに送る
+        int x, y;
+        if (getCell (p, x, y) && t.toMilliseconds() - lastMouseEventTime.toMilliseconds() >= 50)
+        {
+            listeners.call (&Listener::ledClicked, x, y, e.pressure);
+            lastLED = Point<int> (x, y);
+            lastMouseEventTime = t;
+        }
+    }
+    
+    void mouseUp (const MouseEvent&) override
+    {
+        if (lastLED.x >= 0)
+            listeners.call (&Listener::ledReleased, lastLED.x, lastLED.y);
+        
+        lastLED = Point<int> (-1, -1);
     }
     
     //==============================================================================
     /** Sets the colour of one of the LEDComponents */
     void setLEDColour (int x, int y, Colour c)
     {
-        x = jmin (x, 14);
-        y = jmin (y, 14);
+        x = jmin (x, gridWidth - 1);
+        y = jmin (y, gridHeight - 1);
+        
+        leds.getUnchecked ((x * gridHeight) + y)->setColour (c);
+    }
+    
+    //==============================================================================
+    /** Switches between the per-LED child components and the batched mirror painting */
+    void setMirrorMode (bool shouldMirror)
+    {
+        if (mirrorMode == shouldMirror)
+            return;
+        
+        mirrorMode = shouldMirror;
+        
+        for (auto* led : leds)
+            led->setVisible (! mirrorMode);
+        
+        if (mirrorMode)
+            startTimerHz (MIRROR_REFRESH_HZ);
+        else
+            stopTimer();
+        
+        resized();
+        repaint();
+    }
+    
+    bool isMirrorMode() const    { return mirrorMode; }
+    
+    /** Sets how many boards the mirror shows and how many of them go in one row */
+    void setMirrorLayout (int numBoards, int boardsPerRow)
+    {
+        numMirrorBoards = jmax (1, numBoards);
+        mirrorColumns = jlimit (1, numMirrorBoards, boardsPerRow);
+        mirrorPixels.assign ((size_t) (numMirrorBoards * numCells), 0);
+        
+        resized();
+        mirrorDirty = true;
+    }
+    
+    /** Copies one board's frame (RGB565, indexed [x * gridHeight + y]). The repaint happens on the next refresh */
+    void setMirrorFrame (int board, const uint16* rgb565)
+    {
+        if (! isPositiveAndBelow (board, numMirrorBoards))
+            return;
         
-        leds.getUnchecked ((x * 15) + y)->setColour (c);
+        std::memcpy (mirrorPixels.data() + board * numCells, rgb565, sizeof (uint16) * numCells);
+        mirrorDirty = true;
     }
     
     //==============================================================================
@@ -144,18 +233,160 @@ public:
     {
         virtual ~Listener() {}
         
-        /** Called when an LEDComponent has been clicked */
+        /** Called when an LEDComponent has been clicked, and for every LED a drag crosses */
         virtual void ledClicked (int x, int y, float z) = 0;
+        
+        /** Called when the mouse is released. x and y are the last LED it was on */
+        virtual void ledReleased (int x, int y) {}
     };
     
     void addListener (Listener* l)       { listeners.add (l); }
     void removeListener (Listener* l)    { listeners.remove (l); }
     
 private:
+    enum
+    {
+        gridWidth  = game::Board::width,
+        gridHeight = game::Board::height,
+        numCells   = game::Board::numCells
+    };
+    
+    /** The area the LED grid are laid out in (board 0 in mirror mode) */
+    Rectangle<int> getLEDArea() const
+    {
+        return mirrorMode ? getBoardBounds (0).reduced (10) : getLocalBounds().reduced (10);
+    }
+    
+    /** Converts a position to LED units: the integer part is the LED index */
+    Point<float> toCellSpace (Point<float> position) const
+    {
+        auto r = getLEDArea();
+        const float circleWidth  = (float) jmax (1, r.getWidth() / gridWidth);
+        const float circleHeight = (float) jmax (1, r.getHeight() / gridHeight);
+        
+        return { (position.x - r.getX()) / circleWidth, (position.y - r.getY()) / circleHeight };
+    }
+    
+    /** Returns false if the position is outside the grid */
+    static bool getCell (Point<float> cellPosition, int& x, int& y)
+    {
+        x = (int) std::floor (cellPosition.x);
+        y = (int) std::floor (cellPosition.y);
+        
+        return isPositiveAndBelow (x, (int) gridWidth) && isPositiveAndBelow (y, (int) gridHeight);
+    }
+    
+    /** Calls callback (x, y) for every cell the segment enters after the one it starts in, in order */
+    template <typename Callback>
+    static void forEachCellCrossed (Point<float> from, Point<float> to, Callback&& callback)
+    {
+        int x = (int) std::floor (from.x);
+        int y = (int) std::floor (from.y);
+        const int endX = (int) std::floor (to.x);
+        const int endY = (int) std::floor (to.y);
+        
+        const float dx = to.x - from.x;
+        const float dy = to.y - from.y;
+        const int stepX = dx > 0 ? 1 : -1;
+        const int stepY = dy > 0 ? 1 : -1;
+        
+        const float inf = std::numeric_limits<float>::infinity();
+        const float tDeltaX = dx != 0 ? std::abs (1.0f / dx) : inf;
+        const float tDeltaY = dy != 0 ? std::abs (1.0f / dy) : inf;
+        float tMaxX = dx > 0 ? ((float) (x + 1) - from.x) * tDeltaX : (dx < 0 ? (from.x - (float) x) * tDeltaX : inf);
+        float tMaxY = dy > 0 ? ((float) (y + 1) - from.y) * tDeltaY : (dy < 0 ? (from.y - (float) y) * tDeltaY : inf);
+        
+        // 丸め誤差で行き過ぎないように、端の列や行に着いた軸はもう動かさない
+        while (x != endX || y != endY)
+        {
+            if (y == endY || (x != endX && tMaxX < tMaxY))
+            {
+                x += stepX;
+                tMaxX += tDeltaX;
+            }
+            else
+            {
+                y += stepY;
+                tMaxY += tDeltaY;
+            }
+            
+            callback (x, y);
+        }
+    }
+    
+    /** The square for one board in mirror mode */
+    Rectangle<int> getBoardBounds (int board) const
+    {
+        const int gap = 10;
+        const int rows = (numMirrorBoards + mirrorColumns - 1) / mirrorColumns;
+        const int side = jmax (0, jmin ((getWidth()  - gap * (mirrorColumns - 1)) / mirrorColumns,
+                                        (getHeight() - gap * (rows - 1)) / rows));
+        
+        const int originX = (getWidth()  - (side * mirrorColumns + gap * (mirrorColumns - 1))) / 2;
+        const int originY = (getHeight() - (side * rows + gap * (rows - 1))) / 2;
+        
+        return { originX + (board % mirrorColumns) * (side + gap),
+                 originY + (board / mirrorColumns) * (side + gap),
+                 side, side };
+    }
+    
+    void paintMirror (Graphics& g)
+    {
+        for (int b = 0; b < numMirrorBoards; ++b)
+        {
+            auto boardArea = getBoardBounds (b);
+            auto r = boardArea.toFloat();
+            
+            Path outline;
+            outline.addRoundedRectangle (r, r.getWidth() / 20.0f);
+            g.setColour (Colours::black);
+            g.fillPath (outline);
+            
+            auto cells = boardArea.reduced (10);
+            auto circleWidth = cells.getWidth() / gridWidth;
+            auto circleHeight = cells.getHeight() / gridHeight;
+            const uint16* pixels = mirrorPixels.data() + b * numCells;
+            
+            for (auto x = 0; x < gridWidth; ++x)
+            {
+                for (auto y = 0; y < gridHeight; ++y)
+                {
+                    const uint16 p = pixels[x * gridHeight + y];
+                    if (p == 0)
+                        continue;
+                    
+                    uint8 red, green, blue;
+                    game::LEDFrameBuffer::unpackRGB565 (p, red, green, blue);
+                    
+                    g.setColour (Colour (red, green, blue));
+                    g.fillEllipse ((float) (cells.getX() + x * circleWidth), (float) (cells.getY() + y * circleHeight),
+                                   (float) circleWidth, (float) circleHeight);
+                }
+            }
+        }
+    }
+    
+    /** Coalesces setMirrorFrame calls into one repaint per display refresh */
+    void timerCallback() override
+    {
+        if (mirrorDirty)
+        {
+            mirrorDirty = false;
+            repaint();
+        }
+    }
+    
     OwnedArray<LEDComponent> leds;
     ListenerList<Listener> listeners;
     
     Time lastMouseEventTime;
-    Point<int> lastLED;
+    Point<int> lastLED { -1, -1 };
+    Point<float> lastCellPosition;
+    
+    bool mirrorMode = false;
+    bool mirrorDirty = false;
+    int numMirrorBoards = 1;
+    int mirrorColumns = 1;
+    std::vector<uint16> mirrorPixels = std::vector<uint16> (numCells, 0);
 };
 
@@ -24,9 +24,12 @@
  ==============================================================================
  */
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "JuceHeader.h"
 #include "MainComponent.h"
 
+// ヘッドレスのビルドではHeadlessMain.cppのmainを使う
+#if ! BOUND_HEADLESS
+
 //==============================================================================
 class BoundApplication  : public JUCEApplication, public Timer
 {
@@ -93,3 +96,5 @@ private:
 //==============================================================================
 START_JUCE_APPLICATION (BoundApplication)
 
+#endif
+
@@ -45,6 +45,7 @@ MainComponent::MainComponent()
     addAndMakeVisible (lightpadComponent);
     lightpadComponent.setVisible (false);
     lightpadComponent.addListener (this);
+    lightpadComponent.setMirrorMode (true);
     
     clearButton.setButtonText ("Clear");
     clearButton.addListener (this);
@@ -71,8 +72,9 @@ MainComponent::MainComponent()
     
     setSize (600, 600);
     
-    board = new Board();
-    board2 = new Board();
+    // ボードのつなぎ方はLightpadの並びから決める(topologyChanged)
+    world.setScheduler (&scheduler);
+    renderPipeline.setScheduler (&scheduler);
     
     /*
     //Track1. BD color rgb(255, 255, 255)
@@ -145,28 +147,35 @@ MainComponent::MainComponent()
     }
      */
     
-    startTimer(100);
-    
-    // midi
-    MidiOutManager::getSharedInstance();
-    startTimer(80);
-    
-    for(int x=0; x<BLOCKS_SIZE ; x++){
-        for(int y=0; y<BLOCKS_SIZE ; y++){
-            stateLED[x][y].r = 0;
-            stateLED[x][y].g = 0;
-            stateLED[x][y].b = 0;
+    // midi。設定ファイルがなければ元の配線(volcaとmonologue)
+    {
+        MidiRouting routing = MidiRouting::createDefault();
+        routing.loadFromFile (MidiRouting::getDefaultFile());
+        
+        MidiOutManager &outManager = MidiOutManager::getSharedInstance();
+        routing.apply (outManager);
+        
+        for (int i = 0; i < world.getNumBoards(); i++)
+        {
+            world.getBoard (i)->setRoutes (routing.compile (i, outManager));
         }
     }
+    
+    updateMirrorLayout();
+    
+    // ゲームはクロックのスレッド、残像の合成は専用のスレッド、ブロックへの送信はメッセージスレッド
+    renderPipeline.start();
+    startTimer (LED_POLL_INTERVAL_MS);
+    simulationClock.start();
 }
 
 MainComponent::~MainComponent()
 {
-    if (activeBlock != nullptr)
-        detachActiveBlock();
+    simulationClock.stop();
+    renderPipeline.stop();
     
-    if (anotherBlock != nullptr)
-        detachAnotherBlock();
+    for (auto* pad : attachedPads)
+        detachPad (*pad);
     
     lightpadComponent.removeListener (this);
 }
@@ -217,94 +226,209 @@ void MainComponent::resized()
 
 void MainComponent::topologyChanged()
 {
-    stopTimer();
-    lightpadComponent.setVisible (false);
-    infoLabel.setVisible (true);
-    
-    // Reset the activeBlock object
-    if (activeBlock != nullptr)
-        detachActiveBlock();
+    // 変わったところだけ直す。ほかのLightpadのボードは止めないし、ボールも消さない
+    const auto topology = topologySource.getCurrentTopology();
+    blockLayout.update (topology);
     
-    if (anotherBlock != nullptr)
-        detachAnotherBlock();
+    // 抜かれたLightpadを外す。そのボードは見えなくなるので、つなぎなおしたあとで空にする
+    Array<int> removedBoards;
     
-    // Get the array of currently connected Block objects from the PhysicalTopologySource
-    auto blocks = topologySource.getCurrentTopology().blocks;
+    for (int i = attachedPads.size(); --i >= 0;)
+    {
+        auto* pad = attachedPads.getUnchecked (i);
+        
+        if (blockLayout.find (pad->block->uid) == nullptr)
+        {
+            removedBoards.add (pad->boardIndex);
+            detachPad (*pad);
+            attachedPads.remove (i);
+        }
+    }
     
-    // Iterate over the array of Block objects
-    for (auto b : blocks)
+    // 新しいLightpadに空いているボードを渡す
+    for (auto b : topology.blocks)
     {
-        // Find the first Lightpad
-        if (activeBlock == nullptr && b->getType() == Block::Type::lightPadBlock)
+        if (b->getType() != Block::Type::lightPadBlock || findPad (*b) != nullptr)
+            continue;
+        
+        for (int boardIndex = 0; boardIndex < world.getNumBoards(); boardIndex++)
         {
-            activeBlock = b;
+            bool used = false;
+            for (auto* pad : attachedPads)
+                used = used || pad->boardIndex == boardIndex;
             
-            
-            // Register MainContentComponent as a listener to the touch surface
-            if (auto surface = activeBlock->getTouchSurface())
-                surface->addListener (this);
-            
-            // Register MainContentComponent as a listener to any buttons
-            for (auto button : activeBlock->getButtons())
-                button->addListener (this);
-            
-            // Get the LEDGrid object from the Lightpad and set its program to the program for the current mode
-            if (auto grid = activeBlock->getLEDGrid())
+            if (! used)
             {
-                // Work out scale factors to translate X and Y touches to LED indexes
-                scaleX = (float) (grid->getNumColumns() - 1) / activeBlock->getWidth();
-                scaleY = (float) (grid->getNumRows() - 1)    / activeBlock->getHeight();
-                
-                setLEDProgram (*activeBlock);
+                attachPad (b, boardIndex);
+                break;
             }
-            
-            // Make the on screen Lighpad component visible
-            lightpadComponent.setVisible (true);
-            infoLabel.setVisible (false);
         }
-        else if (activeBlock != nullptr && anotherBlock == nullptr && b->getType() == Block::Type::lightPadBlock)
+    }
+    
+    // 向きは残っているLightpadでも変わることがある(基準にしていたブロックが抜かれたとき)
+    for (auto* pad : attachedPads)
+    {
+        if (auto* placement = blockLayout.find (pad->block->uid))
         {
-            anotherBlock = b;
-            /*
-            if (auto surface = anotherBlock->getTouchSurface())
-                surface->addListener (this);
-            */
-            // Register MainContentComponent as a listener to any buttons
-            for (auto button : anotherBlock->getButtons())
-                button->addListener (this);
-            
-            if (auto grid = anotherBlock->getLEDGrid())
+            pad->rotation = placement->rotation;
+            ledRenderer.addBlock (pad->block, pad->boardIndex, pad->rotation);
+        }
+    }
+    
+    // 外すのと空にするのを同じロックの中でやる。間にクロックのスレッドが進めると、
+    // まだつながっているとなりから空にしたボードへボールが渡ってきてしまう
+    {
+        const ScopedLock sl (boardLock);
+        applyLayout();
+        
+        for (auto boardIndex : removedBoards)
+            world.getBoard (boardIndex)->deleteAllBalls();
+    }
+    
+    updateMirrorLayout();
+    
+    lightpadComponent.setVisible (attachedPads.size() > 0);
+    infoLabel.setVisible (attachedPads.size() == 0);
+}
+
+MainComponent::AttachedPad* MainComponent::findPad (const Block& block) const
+{
+    for (auto* pad : attachedPads)
+        if (pad->block->uid == block.uid)
+            return pad;
+    
+    return nullptr;
+}
+
+void MainComponent::attachPad (Block::Ptr block, int boardIndex)
+{
+    auto* pad = attachedPads.add (new AttachedPad());
+    pad->block = block;
+    pad->boardIndex = boardIndex;
+    pad->rotation = 0;
+    pad->scaleX = pad->scaleY = 0;
+    pad->isTap = false;
+    pad->fromX = pad->fromY = 0;
+    
+    // Register MainContentComponent as a listener to the touch surface
+    if (auto surface = block->getTouchSurface())
+        surface->addListener (this);
+    
+    // Register MainContentComponent as a listener to any buttons
+    for (auto button : block->getButtons())
+        button->addListener (this);
+    
+    // Get the LEDGrid object from the Lightpad and set its program to the program for the current mode
+    if (auto grid = block->getLEDGrid())
+    {
+        // Work out scale factors to translate X and Y touches to LED indexes
+        pad->scaleX = (float) (grid->getNumColumns() - 1) / block->getWidth();
+        pad->scaleY = (float) (grid->getNumRows() - 1)    / block->getHeight();
+        
+        ledRenderer.addBlock (block, boardIndex, pad->rotation);
+        setLEDProgram (*block);
+    }
+}
+
+void MainComponent::detachPad (AttachedPad& pad)
+{
+    if (auto surface = pad.block->getTouchSurface())
+        surface->removeListener (this);
+    
+    for (auto button : pad.block->getButtons())
+        button->removeListener (this);
+    
+    ledRenderer.removeBlock (*pad.block);
+}
+
+void MainComponent::applyLayout()
+{
+    // 盤面の向きでのとなり。Lightpadのないボードはどこにもつながない
+    Board* neighbours[MAX_LAYOUT_BOARDS][Direction_Num] = {};
+    
+    for (auto* pad : attachedPads)
+    {
+        const auto* placement = blockLayout.find (pad->block->uid);
+        if (placement == nullptr) continue;
+        
+        for (int d = 0; d < Direction_Num; d++)
+        {
+            for (auto* other : attachedPads)
             {
-                // Work out scale factors to translate X and Y touches to LED indexes
-                scaleX = (float) (grid->getNumColumns() - 1) / anotherBlock->getWidth();
-                scaleY = (float) (grid->getNumRows() - 1)    / anotherBlock->getHeight();
-                
-                setLEDProgram (*anotherBlock);
+                if (placement->neighbours[d] != 0 && other->block->uid == placement->neighbours[d])
+                    neighbours[pad->boardIndex][d] = world.getBoard (other->boardIndex);
             }
+        }
+    }
+    
+    const ScopedLock sl (boardLock);
+    
+    for (int i = 0; i < world.getNumBoards(); i++)
+    {
+        Board *b = world.getBoard (i);
+        
+        for (int d = 0; d < Direction_Num; d++)
+        {
+            if (b->getConnectedBoard ((Direction) d) == neighbours[i][d]) continue;
             
-            // 下につなぐ(決め打ち)
-            board->connect(board2, Direction_Bottom);
-            board2->connect(board, Direction_Top);
-            board2->deleteAllBalls();
-            break;
+            if (neighbours[i][d] != nullptr)
+                b->connect (neighbours[i][d], (Direction) d);
+            else
+                b->disConnect ((Direction) d);
         }
     }
+}
+
+void MainComponent::updateMirrorLayout()
+{
+    // まとまりごとに1列あけて横に並べる。Lightpadがなければマウスで遊べるように0番のボードだけ映す
+    const int numIslands = blockLayout.getNumIslands();
+    int columns = 0, rows = 1;
+    Array<int> islandColumn;
+    
+    for (int island = 0; island < numIslands; island++)
+    {
+        if (island > 0) columns++;
+        islandColumn.add (columns);
+        
+        const auto size = blockLayout.getIslandSize (island);
+        columns += size.x;
+        rows = jmax (rows, size.y);
+    }
+    
+    mirrorBoards.clearQuick();
+    
+    if (attachedPads.size() == 0)
+    {
+        mirrorBoards.add (0);
+        lightpadComponent.setMirrorLayout (1, 1);
+        return;
+    }
+    
+    for (int i = 0; i < columns * rows; i++)
+        mirrorBoards.add (-1);
     
-    if (anotherBlock == nullptr)
+    for (auto* pad : attachedPads)
     {
-        board->disConnect(Direction_Bottom);
-        board2->disConnect(Direction_Top);
+        if (auto* placement = blockLayout.find (pad->block->uid))
+            mirrorBoards.set (placement->row * columns + islandColumn[placement->island] + placement->column, pad->boardIndex);
     }
     
-    startTimer(100);
+    lightpadComponent.setMirrorLayout (columns * rows, columns);
 }
 
-
 //==============================================================================
-void MainComponent::touchChanged (TouchSurface&, const TouchSurface::Touch& touch)
+void MainComponent::touchChanged (TouchSurface& surface, const TouchSurface::Touch& touch)
 {
-    auto x = roundToInt(touch.x * scaleX);
-    auto y = roundToInt(touch.y * scaleY);
+    auto* pad = findPad (surface.block);
+    if (pad == nullptr)
+        return;
+    
+    // ブロックの向きから盤面のマスにする
+    int x, y;
+    BlockLayout::blockToBoard (pad->rotation,
+                               jlimit (0, BLOCKS_SIZE - 1, roundToInt (touch.x * pad->scaleX)),
+                               jlimit (0, BLOCKS_SIZE - 1, roundToInt (touch.y * pad->scaleY)), x, y);
     auto z = touch.z;
     
     if( z <= 0.4 ){
@@ -319,20 +443,11 @@ void MainComponent::touchChanged (TouchSurface&, const TouchSurface::Touch& touc
     {
 
         
-        if( isTap && z == 0 ){
-            if( oldX != x && oldY != y )
+        if( pad->isTap && z == 0 ){
+            if( pad->fromX != x && pad->fromY != y )
             {
-                Ball ball;
-                ball.px = x;
-                ball.py = y;
-                ball.vx = (float)(oldX - x) / 2.f;
-                ball.vy = (float)(oldY - y) / 2.f;
-                ball.r = 255;
-                ball.g = 255;
-                ball.b = 255;
-                
-                board->addBall(ball);
-                isTap = false;
+                launchBall (pad->boardIndex, x, y, pad->fromX, pad->fromY);
+                pad->isTap = false;
                 //std::cout << "measured(" << x << ", " << y << ", " << oldX << ", " << oldY << ")" << std::endl;
                 //std::cout << "out(" << oldX-x << ", "<< oldY-y << ")" << std::endl;
                 
@@ -343,10 +458,10 @@ void MainComponent::touchChanged (TouchSurface&, const TouchSurface::Touch& touc
             }
         }
         
-        if( z != 0 && !isTap ){
-            isTap = true;
-            oldX = x;
-            oldY = y;
+        if( z != 0 && !pad->isTap ){
+            pad->isTap = true;
+            pad->fromX = x;
+            pad->fromY = y;
             printf("measure\n");
             std::cout << "measured(" << x << ", " << y << ", " << z << ")" << std::endl;
         }
@@ -460,37 +575,72 @@ void MainComponent::sliderValueChanged (Slider* s)
 void MainComponent::timerCallback()
 {
     redrawLEDs();
-    board->move();
-    board2->move();
+}
+
+void MainComponent::simulationTick (int64 tickIndex, double tickTimeMs)
+{
+    const double interval = simulationClock.getTickInterval();
+    
+    const ScopedLock sl (boardLock);
+    const double start = Time::getMillisecondCounterHiRes();
+    world.move (tickTimeMs, interval);
+    
+    // 盤面を写してcomposeのスレッドに渡す
+    renderPipeline.publish (world.getBoards(), world.getNumBoards(), tickIndex, tickTimeMs, Time::getMillisecondCounterHiRes() - start);
 }
 
 void MainComponent::ledClicked (int x, int y, float z)
 {
+    // 画面の上でもLightpadと同じように、押したところから引っ張って離すとボールを投げる
+    if (! mouseFlick)
+    {
+        mouseFlick = true;
+        mouseFromX = x;
+        mouseFromY = y;
+    }
 }
 
-void MainComponent::detachActiveBlock()
+void MainComponent::ledReleased (int x, int y)
 {
-    if (auto surface = activeBlock->getTouchSurface())
-        surface->removeListener (this);
+    // マウスで触れるのはミラーの左上のボード
+    if (mouseFlick && (mouseFromX != x || mouseFromY != y) && mirrorBoards[0] >= 0)
+        launchBall (mirrorBoards[0], x, y, mouseFromX, mouseFromY);
     
-    for (auto button : activeBlock->getButtons())
-        button->removeListener (this);
-    
-    activeBlock = nullptr;
+    mouseFlick = false;
 }
 
-void MainComponent::detachAnotherBlock()
+void MainComponent::launchBall (int boardIndex, int x, int y, int fromX, int fromY)
 {
-    if (auto surface = anotherBlock->getTouchSurface())
-        surface->removeListener (this);
-    
-    anotherBlock = nullptr;
+    if (! isPositiveAndBelow (boardIndex, world.getNumBoards()))
+        return;
+    
+    Ball ball;
+    ball.px = x;
+    ball.py = y;
+    ball.vx = (float)(fromX - x) / 2.f;
+    ball.vy = (float)(fromY - y) / 2.f;
+    ball.r = 255;
+    ball.g = 255;
+    ball.b = 255;
+    ball.lifespan = -1;
+    ball.id = -1; // addBallで振られる
+    ball.noteNum = MidiRouting::getLaunchTrack (numBallsLaunched++);
+    
+    const ScopedLock sl (boardLock);
+    world.getBoard (boardIndex)->addBall (ball);
 }
 
 void MainComponent::setLEDProgram (Block& block)
 {
     
-    block.setProgram (new BitmapLEDProgram (block));
+    // 残像をLightpadの上で描くときはボールのマスだけ送ればいい
+    if (renderTrailsOnDevice)
+        block.setProgram (new BallTrailProgram (block));
+    else
+        block.setProgram (new BitmapLEDProgram (block));
+    
+    // 新しいプログラムの中身はわからないので次は全部送る
+    ledRenderer.invalidate (block);
     
     // Redraw any previously drawn LEDs
     redrawLEDs();
@@ -498,14 +648,15 @@ void MainComponent::setLEDProgram (Block& block)
 
 void MainComponent::clearLEDs()
 {
-    if (auto* canvasProgram = getCanvasProgram())
+    renderPipeline.clearTrails();
+    ledRenderer.clearLEDs();
+    
+    if (attachedPads.size() > 0)
     {
-        // Clear the LED grid
-        for (uint32 x = 0; x < 15; ++x)
+        for (int x = 0; x < Board::width; ++x)
         {
-            for (uint32 y = 0; y < 15; ++ y)
+            for (int y = 0; y < Board::height; ++y)
             {
-                canvasProgram->setLED (x, y, Colours::black);
                 lightpadComponent.setLEDColour (x, y, Colours::black);
             }
         }
@@ -521,106 +672,17 @@ void MainComponent::drawLED (uint32 x0, uint32 y0, float z, Colour drawColour)
 }
 
 void MainComponent::redrawLEDs(){
-    if (auto* canvasProgram = getCanvasProgram()){
-        for (int y = 0; y < BLOCKS_SIZE; y++){
-            for (int x = 0; x < BLOCKS_SIZE; x++){
-                //ボール等描画前にキャンバスの下地をリセット
-                canvasProgram->setLED(x, y, Colour(stateLED[x][y].r, stateLED[x][y].g, stateLED[x][y].b));
-                //LEDを減衰
-                stateLED[x][y].r = stateLED[x][y].r*LEDDECAY ;
-                stateLED[x][y].g = stateLED[x][y].g*LEDDECAY ;
-                stateLED[x][y].b = stateLED[x][y].b*LEDDECAY ;
-            }
-        }
-        for (int y = 0; y < BLOCKS_SIZE; y++){
-            for (int x = 0; x < BLOCKS_SIZE; x++){
-                //壁を塗る
-                if( ((x == 0)||(x == BLOCKS_SIZE -1)) || ((y == 0)||(y == BLOCKS_SIZE -1)) ){
-                    //canvasProgram->setLED(x, y, Colour(255/4, 255/4, 255/4));
-                }
-                BoardState state = board->getBoardState(x, y);
-                switch (state.c)
-                {
-                    case Charactor_Wall:
-                        //canvasProgram->setLED(x, y, Colour(255/4, 255/4, 255/4));
-                        break;
-                        
-                    case Charactor_Ball:
-                    {
-                        stateLED[x][y].r = state.r;//stateLED[x][y].r + state.r;
-                        stateLED[x][y].g = state.g;//stateLED[x][y].g + state.g;
-                        stateLED[x][y].b = state.b;//stateLED[x][y].b + state.b;
-                        canvasProgram->setLED(x, y, Colour(stateLED[x][y].r, stateLED[x][y].g, stateLED[x][y].b));
-                        
-                        //壁ピンク化チンパンコード
-                        if( (x <= 1)){
-                            stateLED[x-1][y].r = state.r;
-                            stateLED[x-1][y].g = state.g;
-                            stateLED[x-1][y].b = state.b;
-                            
-                            stateLED[x-1][y+1].r = state.r;
-                            stateLED[x-1][y+1].g = state.g;
-                            stateLED[x-1][y+1].b = state.b;
-                            
-                            stateLED[x-1][y-1].r = state.r;
-                            stateLED[x-1][y-1].g = state.g;
-                            stateLED[x-1][y-1].b = state.b;
-                        }
-                        if(x>= BLOCKS_SIZE-2){
-                            stateLED[x+1][y].r = state.r;
-                            stateLED[x+1][y].g = state.g;
-                            stateLED[x+1][y].b = state.b;
-                            
-                            stateLED[x+1][y+1].r = state.r;
-                            stateLED[x+1][y+1].g = state.g;
-                            stateLED[x+1][y+1].b = state.b;
-                            
-                            stateLED[x+1][y-1].r = state.r;
-                            stateLED[x+1][y-1].g = state.g;
-                            stateLED[x+1][y-1].b = state.b;
-                        }
-                        if( (y <= 1)){
-                            stateLED[x][y-1].r = state.r;
-                            stateLED[x][y-1].g = state.g;
-                            stateLED[x][y-1].b = state.b;
-                            
-                            stateLED[x+1][y-1].r = state.r;
-                            stateLED[x+1][y-1].g = state.g;
-                            stateLED[x+1][y-1].b = state.b;
-                            
-                            stateLED[x-1][y-1].r = state.r;
-                            stateLED[x-1][y-1].g = state.g;
-                            stateLED[x-1][y-1].b = state.b;
-                        }
-                        if(y>=BLOCKS_SIZE-2){
-                            stateLED[x][y+1].r = state.r;
-                            stateLED[x][y+1].g = state.g;
-                            stateLED[x][y+1].b = state.b;
-                            
-                            stateLED[x+1][y+1].r = state.r;
-                            stateLED[x+1][y+1].g = state.g;
-                            stateLED[x+1][y+1].b = state.b;
-                            
-                            stateLED[x-1][y+1].r = state.r;
-                            stateLED[x-1][y+1].g = state.g;
-                            stateLED[x-1][y+1].b = state.b;
-                            //std::cout << "yyy" << y << std::endl;
-                        }
-                        break;
-                    }
-                    default:
-                        //canvasProgram->setLED(x, y, Colour(stateLED[x][y].r, stateLED[x][y].g, stateLED[x][y].b));
-                        break;
-                }
-            }
-        }
-        //引っ張り軌道
-        for (int y = 0; y < BLOCKS_SIZE; y++){
-            for (int x = 0; x < BLOCKS_SIZE; x++){
-                
-            }
-        }
-        
-    }
+    // composeが済んだ一番新しいフレームだけ送る。送るのが遅れたら間のフレームは捨てる
+    const ComposedFrame* frame;
+    if (! renderPipeline.acquire (frame))
+        return;
+    
+    const double start = Time::getMillisecondCounterHiRes();
+    ledRenderer.render (*frame);
+    renderPipeline.finishedTransmit (*frame, Time::getMillisecondCounterHiRes() - start);
+    
+    // 画面のミラーは同じフレームをコピーするだけ。描くのは次のリフレッシュでまとめて
+    for (int slot = 0; slot < mirrorBoards.size(); slot++)
+        if (isPositiveAndBelow (mirrorBoards[slot], frame->numBoards))
+            lightpadComponent.setMirrorFrame (slot, frame->rgb565[mirrorBoards[slot]]);
 }
-
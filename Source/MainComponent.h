@@ -26,10 +26,14 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "JuceHeader.h"
 #include "LightpadComponent.h"
 #include "Game.h"
+#include "BoardWorld.h"
 #include "MidiOutManager.h"
+#include "SimulationClock.h"
+#include "LEDRenderer.h"
+#include "BlockLayout.h"
 
 //==============================================================================
 /**
@@ -122,6 +126,7 @@ private ControlButton::Listener,
 private LightpadComponent::Listener,
 private Button::Listener,
 private Slider::Listener,
+private SimulationClock::Listener,
 private Timer
 {
 public:
@@ -154,6 +159,10 @@ private:
     void buttonReleased (ControlButton&, Block::Timestamp) override;
     
     void ledClicked (int x, int y, float z) override;
+    void ledReleased (int x, int y) override;
+    
+    /** Adds a ball at (x, y) on the given board, flung away from (fromX, fromY), like pulling a slingshot */
+    void launchBall (int boardIndex, int x, int y, int fromX, int fromY);
     
     void buttonClicked (Button*) override;
     
@@ -161,9 +170,33 @@ private:
     
     void timerCallback() override;
     
-    /** Removes TouchSurface and ControlButton listeners and sets activeBlock to nullptr */
-    void detachActiveBlock();
-    void detachAnotherBlock();
+    /** Overridden from SimulationClock::Listener. Steps the boards on the clock thread */
+    void simulationTick (int64 tickIndex, double tickTimeMs) override;
+    
+    /** Lightpad 1枚ぶん。どのボードを描いて、どちらを向いているか */
+    struct AttachedPad
+    {
+        Block::Ptr block;
+        int boardIndex;
+        int rotation;      // BlockLayout::Placement::rotation
+        float scaleX, scaleY;
+        bool isTap;
+        int fromX, fromY;  // 押したところ(盤面のマス)
+    };
+    
+    AttachedPad* findPad (const Block&) const;
+    
+    /** Adds TouchSurface and ControlButton listeners and sets the LED program */
+    void attachPad (Block::Ptr, int boardIndex);
+    
+    /** Removes TouchSurface and ControlButton listeners and stops drawing on the block */
+    void detachPad (AttachedPad&);
+    
+    /** blockLayoutのとなりをボードのつながりにする。変わった辺だけつなぎ直す。boardLockを取る(呼ぶ側で取っていてもいい) */
+    void applyLayout();
+    
+    /** 画面のミラーにまとまりごとに横に並べる */
+    void updateMirrorLayout();
     
     /** Sets the LEDGrid Program for the selected mode */
     void setLEDProgram (Block&);
@@ -179,24 +212,16 @@ private:
     //==============================================================================
     BitmapLEDProgram* getCanvasProgram()
     {
-        if (activeBlock != nullptr)
-            return dynamic_cast<BitmapLEDProgram*> (activeBlock->getProgram());
-        
-        return nullptr;
-    }
-    
-    BitmapLEDProgram* getAnotherCanvasProgram()
-    {
-        if (anotherBlock != nullptr)
-            return dynamic_cast<BitmapLEDProgram*> (anotherBlock->getProgram());
+        if (attachedPads.size() > 0)
+            return dynamic_cast<BitmapLEDProgram*> (attachedPads.getFirst()->block->getProgram());
         
         return nullptr;
     }
     
     DrumPadGridProgram* getPaletteProgram()
     {
-        if (activeBlock != nullptr)
-            return dynamic_cast<DrumPadGridProgram*> (activeBlock->getProgram());
+        if (attachedPads.size() > 0)
+            return dynamic_cast<DrumPadGridProgram*> (attachedPads.getFirst()->block->getProgram());
         
         return nullptr;
     }
@@ -240,13 +265,12 @@ private:
     //==============================================================================
     ColourGrid layout { 3, 3 };
     PhysicalTopologySource topologySource;
-    Block::Ptr activeBlock;
-    Block::Ptr anotherBlock;
-    
-    float scaleX = 0.0;
-    float scaleY = 0.0;
+    OwnedArray<AttachedPad> attachedPads;
+    BlockLayout blockLayout;
+    Array<int> mirrorBoards; // 画面のミラーのマスごとのボード。-1なら空き
     
     bool doublePress = false;
+    int numBallsLaunched = 0; // 投げたボールの数。トラックを決める
     
     Label infoLabel;
     LightpadComponent lightpadComponent;
@@ -258,15 +282,18 @@ private:
     TextButton connectButton;
 #endif
     
-    game::Board *board;
-    game::Board *board2;
+    TaskScheduler scheduler; // ボードを進めるのと残像の合成で共有する
+    game::BoardWorld world { MAX_LAYOUT_BOARDS, 1, MAX_BALLS_PER_BOARD }; // Lightpadごとに1枚。つなぎ方はblockLayoutから
+    CriticalSection boardLock; // ボードはクロックのスレッドからも触る
+    RenderPipeline renderPipeline;
+    SimulationClock simulationClock { *this };
     unsigned int lastX = 0, lastY = 0;
-    bool isTap = false;
-    int oldX = 0;
-    int oldY = 0;
     int mode = 0;
-    game::BoardState stateLED[2][BLOCKS_SIZE][BLOCKS_SIZE];
+    LEDRenderer ledRenderer; // ブロックごとのフレームバッファ
+    bool renderTrailsOnDevice = true; // falseならBitmapLEDProgramにして残像もホストで描く
     bool pressed = false;
+    bool mouseFlick = false; // 画面のミラーを押している間
+    int mouseFromX = 0, mouseFromY = 0;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MainComponent)
 };
@@ -0,0 +1,112 @@
+//
+//  MidiBackend.h
+//  Bound - App
+//
+//  MidiOutManagerが開いたデバイスの送り先。
+//  実機のMIDI出力のほかに、仮想ポート(LinuxならALSAのシーケンサのポート、macならCoreMIDI)と、どこにも送らないキャプチャを選べる。
+//  シンセのないCIのマシンでも、送ったメッセージとその時刻をそのまま取れるようにするため。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+
+enum MidiBackendType
+{
+    MidiBackend_Device,      // MidiOutput::getDevices()の名前で開く
+    MidiBackend_VirtualPort, // MidiOutput::createNewDeviceで作る。ほかのアプリからつなげる
+    MidiBackend_Capture,     // どこにも送らない。MidiOutManagerのキャプチャにだけ残る
+};
+
+// 送ったメッセージごとの時刻(Time::getMillisecondCounterHiRes()の値)
+struct MidiTimestamp
+{
+    double eventTime;     // 鳴らしたかった時刻(衝突の時刻)。時刻を指定しなかったノートは0
+    double queuedTime;    // playNoteを呼んだ時刻
+    double scheduledTime; // 送る予定の時刻。eventTime + scheduleDelay - latency
+    double sentTime;      // 実際に送った時刻
+};
+
+struct CapturedMidiMessage
+{
+    int device;
+    uint8 data[3];
+    MidiTimestamp time;
+    
+    bool isNoteOn() const  { return (data[0] & 0xf0) == 0x90 && data[2] != 0; }
+};
+
+class MidiBackend
+{
+public:
+    virtual ~MidiBackend() {}
+    
+    virtual MidiBackendType getType() const = 0;
+    
+    /** 送れる状態か。見つからなかったデバイスはfalse(送っても何もしない) */
+    virtual bool isAvailable() const = 0;
+    
+    /** MidiOutManagerの送信スレッドから呼ぶ */
+    virtual void send (const MidiMessage& message) = 0;
+    
+    /** typeのバックエンドを作る。nameはデバイスの名前(仮想ポートならそのポートの名前) */
+    static MidiBackend* create (MidiBackendType type, const String& name);
+};
+
+//==============================================================================
+class DeviceMidiBackend : public MidiBackend
+{
+public:
+    DeviceMidiBackend (const String& name)
+        : output (MidiOutput::openDevice (MidiOutput::getDevices().indexOf (name))) {}
+    
+    MidiBackendType getType() const override  { return MidiBackend_Device; }
+    bool isAvailable() const override         { return output != nullptr; }
+    
+    void send (const MidiMessage& message) override
+    {
+        if (output != nullptr)
+            output->sendMessageNow (message);
+    }
+
+private:
+    ScopedPointer<MidiOutput> output;
+};
+
+class VirtualPortMidiBackend : public MidiBackend
+{
+public:
+    VirtualPortMidiBackend (const String& name)
+        : output (MidiOutput::createNewDevice ("Bound " + name)) {}
+    
+    MidiBackendType getType() const override  { return MidiBackend_VirtualPort; }
+    bool isAvailable() const override         { return output != nullptr; }
+    
+    void send (const MidiMessage& message) override
+    {
+        if (output != nullptr)
+            output->sendMessageNow (message);
+    }
+
+private:
+    ScopedPointer<MidiOutput> output; // Windowsでは作れないのでnullptr
+};
+
+class CaptureMidiBackend : public MidiBackend
+{
+public:
+    MidiBackendType getType() const override  { return MidiBackend_Capture; }
+    bool isAvailable() const override         { return true; }
+    void send (const MidiMessage&) override    {}
+};
+
+inline MidiBackend* MidiBackend::create (MidiBackendType type, const String& name)
+{
+    switch (type)
+    {
+        case MidiBackend_VirtualPort: return new VirtualPortMidiBackend (name);
+        case MidiBackend_Capture:     return new CaptureMidiBackend();
+        case MidiBackend_Device:
+        default:                      return new DeviceMidiBackend (name);
+    }
+}
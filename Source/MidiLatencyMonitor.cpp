@@ -0,0 +1,119 @@
+//
+//  MidiLatencyMonitor.cpp
+//  Bound - App
+//
+
+#include "MidiLatencyMonitor.h"
+#include <algorithm>
+#include <cmath>
+
+MidiLatencyMonitor::MidiLatencyMonitor()
+{
+    delays.reserve (MAX_LATENCY_SAMPLES);
+    lateness.reserve (MAX_LATENCY_SAMPLES);
+}
+
+int MidiLatencyMonitor::drain (MidiOutManager& manager)
+{
+    int n = 0;
+    CapturedMidiMessage m;
+
+    while (manager.popCaptured (m))
+    {
+        add (m);
+        n++;
+    }
+
+    // managerの数は増えるだけなので、前に読んだときからの差を足す。resetしたあとはそこから数える
+    const int dropped = manager.getNumDroppedCaptures();
+    numDropped += dropped - lastNumDropped;
+    lastNumDropped = dropped;
+    return n;
+}
+
+void MidiLatencyMonitor::add (const CapturedMidiMessage& m)
+{
+    numMessages++;
+
+    // ノートオフはゲート時間ぶん後なので数えない。時刻を指定しなかったノートは衝突の時刻がわからない
+    if (! m.isNoteOn() || m.time.eventTime <= 0)
+        return;
+
+    const double delay = m.time.sentTime - m.time.eventTime;
+    const double late = m.time.sentTime - m.time.scheduledTime;
+
+    if ((int) delays.size() < MAX_LATENCY_SAMPLES)
+    {
+        delays.push_back (delay);
+        lateness.push_back (late);
+    }
+    else
+    {
+        delays[(size_t) next] = delay;
+        lateness[(size_t) next] = late;
+        next = (next + 1) % MAX_LATENCY_SAMPLES;
+    }
+
+    numNotes++;
+}
+
+void MidiLatencyMonitor::reset()
+{
+    delays.clear();
+    lateness.clear();
+    next = 0;
+    numMessages = numNotes = 0;
+    numDropped = 0;
+}
+
+MidiLatencyMonitor::Percentiles MidiLatencyMonitor::getPercentiles (std::vector<double>& values)
+{
+    Percentiles p = { 0, 0, 0, 0 };
+    if (values.empty()) return p;
+
+    std::sort (values.begin(), values.end());
+
+    // nearest-rank
+    auto at = [&values] (double q) { return values[(size_t) jlimit (0, (int) values.size() - 1, (int) std::ceil (q * values.size()) - 1)]; };
+
+    p.p50 = at (0.50);
+    p.p90 = at (0.90);
+    p.p99 = at (0.99);
+    p.max = values.back();
+    return p;
+}
+
+MidiLatencyMonitor::Report MidiLatencyMonitor::getReport() const
+{
+    Report r;
+    r.numMessages = numMessages;
+    r.numNotes = numNotes;
+    r.numDropped = numDropped;
+
+    std::vector<double> sorted (delays);
+    r.delay = getPercentiles (sorted);
+
+    const double median = r.delay.p50;
+    for (auto& d : sorted)
+        d = std::abs (d - median);
+
+    r.jitter = getPercentiles (sorted);
+
+    sorted = lateness;
+    r.lateness = getPercentiles (sorted);
+    return r;
+}
+
+String MidiLatencyMonitor::toString (const Report& r)
+{
+    auto format = [] (const char* name, const Percentiles& p)
+    {
+        return String (name) + " p50/p90/p99/max " + String (p.p50, 2) + "/" + String (p.p90, 2) + "/"
+             + String (p.p99, 2) + "/" + String (p.max, 2) + "ms";
+    };
+
+    return "midi notes " + String (r.numNotes) + " (messages " + String (r.numMessages) + ", dropped " + String (r.numDropped) + ")"
+         + ", " + format ("delay", r.delay)
+         + ", " + format ("late", r.lateness)
+         + ", " + format ("jitter", r.jitter);
+}
@@ -0,0 +1,63 @@
+//
+//  MidiLatencyMonitor.h
+//  Bound - App
+//
+//  MidiOutManagerのキャプチャを読んで、衝突からメッセージを送るまでの遅れとジッタをパーセンタイルで出す。
+//  シンセがなくてもキャプチャのバックエンドで測れるので、CIのマシンで遅れの予算を決めておける。
+//
+//  衝突の時刻(eventTime)はゲームがつけたもの。PhysicsMode_Stepの壁の反射はターンの区切りで向きを変えるので、
+//  そのターンの予定時刻になる(ターンの中の時刻はない)。ボール同士の衝突とPhysicsMode_Eventは、ターンの中で触れた時刻。
+//  なのでStepではdelayは「ターンの予定時刻から送るまで」で、壁の反射がターンの中のどこで起きたかのずれは入らない。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "MidiOutManager.h"
+#include <vector>
+
+#define MAX_LATENCY_SAMPLES 65536 // これより多いときは古いものから上書きする
+
+class MidiLatencyMonitor
+{
+public:
+    struct Percentiles
+    {
+        double p50, p90, p99, max; // ms
+    };
+    
+    struct Report
+    {
+        int64 numMessages;    // 読んだメッセージ(ノートオフも)
+        int64 numNotes;       // 測ったノートオン(時刻を指定したものだけ)
+        int numDropped;       // キャプチャのキューがあふれた数
+        Percentiles delay;    // 衝突の時刻から送るまで。scheduleDelayも入る。衝突の時刻はNoteEvent::timeで、下の注意を見ること
+        Percentiles lateness; // 送る予定の時刻から実際に送るまで
+        Percentiles jitter;   // delayの中央値からのずれ(絶対値)
+    };
+    
+    MidiLatencyMonitor();
+    
+    /** managerのキャプチャを全部読む。読む側はひとつのスレッドだけ。読んだ数を返す */
+    int drain (MidiOutManager& manager);
+    
+    void add (const CapturedMidiMessage& m);
+    /** 読んだものと、あふれた数を0にする */
+    void reset();
+    
+    Report getReport() const;
+    
+    /** "notes 1234, delay p50/p90/p99/max 80.1/80.4/81.2/83.0ms, ..." */
+    static String toString (const Report& report);
+
+private:
+    static Percentiles getPercentiles (std::vector<double>& sorted);
+    
+    std::vector<double> delays, lateness; // MAX_LATENCY_SAMPLESのリング
+    int next = 0;
+    int64 numMessages = 0, numNotes = 0;
+    int numDropped = 0;
+    int lastNumDropped = 0; // 前のdrainで読んだmanagerのあふれた数
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiLatencyMonitor)
+};
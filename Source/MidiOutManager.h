@@ -7,13 +7,43 @@
 
 #pragma once
 
-#include "../JuceLibraryCode/JuceHeader.h"
+#include "JuceHeader.h"
+#include "SpscQueue.h"
+#include "MidiBackend.h"
+#include "AllocationCounter.h"
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <limits>
 
-// Duo-Capture ExにVolca Sampleを繋いだ時オンリーの実装(Note offしてない)
+// 開いたMIDI出力デバイスにノートを送る。どのボールをどのデバイスに送るかはMidiRoutingで決める。
+// ノートオフはノートオンごとにゲート時間後にひとつだけ送る。
 
-#define GATETIME 50
+#define GATETIME 50          // volcaのゲート時間(ms)
+#define GATE_UNIT_MS 100     // monologueのシーケンスのゲート時間の単位(ms)
+#define NOTE_QUEUE_SIZE 4096 // ゲームから送信スレッドへのキューの長さ
+#define MAX_MIDI_DEVICES 16
+#define MIDI_CAPTURE_SIZE 16384 // 送ったメッセージを読む側に渡すキューの長さ
 
-class MidiOutManager : public Timer
+// ゲーム側で起きた衝突。送信スレッドがMIDIメッセージにして送る
+struct NoteEvent
+{
+    int device;   // openDeviceが返した番号
+    int channel;  // 1 - 16
+    int note;
+    int velocity;
+    int gate;     // ゲート時間(ms)
+    double time;  // 鳴らしたい時刻(Time::getMillisecondCounterHiRes()の値)。0ならすぐ
+    double queued; // playNoteを呼んだ時刻
+};
+
+// playNoteはキューに積むだけで、実際の送信は専用のスレッドでやる。
+// 積む側はゲームのスレッドひとつだけにすること(SPSC)。
+// 時刻を指定したノートは time + scheduleDelay - そのデバイスのlatency に送る。
+// scheduleDelayを一番遅いデバイスのlatency以上にしておけば、全部のシンセで同時に鳴る。
+// 送り先はデバイスごとにMidiBackendで、名前が"virtual:"で始まれば仮想ポート、"capture:"ならキャプチャ、それ以外はsetDefaultBackendのもの。
+// キャプチャを有効にすると、どのバックエンドに送ったメッセージも時刻をつけてpopCapturedで読める。
+class MidiOutManager : private Thread
 {
 public:
     static MidiOutManager& getSharedInstance()
@@ -22,72 +52,255 @@ public:
         return sharedInstance;
     }
     
-    void playVolcaSound(char ch)
+    // 名前でデバイスを開いて番号を返す。もう開いていればその番号。見つからなくても番号は振る(送っても何もしない)
+    // バックエンドを作る(ALSAのポートを開くなど)のは遅いので、ロックの外でやってから差し込む。送信スレッドを待たせない
+    int openDevice(const String &name)
     {
-        MidiMessage midiMessage = MidiMessage (0x90 | ch, 0x00, 0x7f, 0);
-        if (volcaMidiOut != nullptr)
+        MidiBackendType type;
         {
-            volcaMidiOut->sendMessageNow(midiMessage);
+            const ScopedLock sl(deviceLock);
+            
+            const int existing = deviceNames.indexOf(name);
+            if (existing >= 0) return existing;
+            
+            if (deviceNames.size() >= MAX_MIDI_DEVICES) return -1;
+            
+            type = defaultBackend;
         }
+        
+        String portName = name;
+        
+        if (name.startsWith("virtual:"))      { type = MidiBackend_VirtualPort; portName = name.substring(8); }
+        else if (name.startsWith("capture:")) { type = MidiBackend_Capture;     portName = name.substring(8); }
+        
+        ScopedPointer<MidiBackend> backend(MidiBackend::create(type, portName));
+        
+        const ScopedLock sl(deviceLock);
+        
+        // 作っている間にほかのスレッドが同じ名前で開いていたら、作ったものは捨てる
+        const int existing = deviceNames.indexOf(name);
+        if (existing >= 0) return existing;
+        
+        if (deviceNames.size() >= MAX_MIDI_DEVICES) return -1;
+        
+        const int d = deviceNames.size();
+        deviceNames.add(name);
+        backends[d] = backend.release();
+        return d;
+    }
+    
+    // これから開くデバイスの送り先。ルーティングはそのままで、全部を仮想ポートやキャプチャに向けるときに使う
+    void setDefaultBackend(MidiBackendType type) { const ScopedLock sl(deviceLock); defaultBackend = type; }
+    MidiBackendType getDefaultBackend() const    { const ScopedLock sl(deviceLock); return defaultBackend; }
+    
+    int getNumDevices() const                { const ScopedLock sl(deviceLock); return deviceNames.size(); }
+    String getDeviceName(int device) const   { const ScopedLock sl(deviceLock); return deviceNames[device]; }
+    bool isDeviceAvailable(int device) const { const ScopedLock sl(deviceLock); return isPositiveAndBelow(device, MAX_MIDI_DEVICES) && backends[device] != nullptr && backends[device]->isAvailable(); }
+    
+    // そのデバイスを開いたバックエンド。範囲外ならMidiBackend_Device
+    MidiBackendType getDeviceBackend(int device) const
+    {
+        const ScopedLock sl(deviceLock);
+        return isPositiveAndBelow(device, MAX_MIDI_DEVICES) && backends[device] != nullptr ? backends[device]->getType() : MidiBackend_Device;
     }
     
-    void playMonologueSound(int note, int time)
+    // 送ったメッセージを時刻つきでとっておくか。読む側はひとつだけ
+    void setCaptureEnabled(bool enabled)        { captureEnabled = enabled ? 1 : 0; }
+    bool isCaptureEnabled() const               { return captureEnabled.get() != 0; }
+    bool popCaptured(CapturedMidiMessage &m)    { return capture.pop(m); }
+    int getNumDroppedCaptures() const           { return capture.getNumDropped(); }
+    
+    void playNote(int device, int channel, int note, int velocity, int gateMs, double timeMs = 0)
+    {
+        NoteEvent e;
+        e.device = device;
+        e.channel = channel;
+        e.note = note;
+        e.velocity = velocity;
+        e.gate = gateMs;
+        e.time = timeMs;
+        e.queued = Time::getMillisecondCounterHiRes();
+        noteQueue.push(e);
+    }
+    
+    int getNumDroppedNotes() const { return noteQueue.getNumDropped(); }
+    
+    // デバイスごとの出力の遅れ(ms)。その分だけ早く送る
+    void setOutputLatency(int device, double ms) { if (isPositiveAndBelow(device, MAX_MIDI_DEVICES)) outputLatency[device] = ms; }
+    double getOutputLatency(int device) const    { return isPositiveAndBelow(device, MAX_MIDI_DEVICES) ? outputLatency[device].get() : 0; }
+    
+    // 時刻指定のノートに足す遅れ(ms)
+    void setScheduleDelay(double ms) { scheduleDelay = ms; }
+    double getScheduleDelay() const  { return scheduleDelay.get(); }
+    
+private:
+    MidiOutManager() : Thread("Bound MIDI sender"), noteQueue(NOTE_QUEUE_SIZE), capture(MIDI_CAPTURE_SIZE)
     {
-        MidiMessage midiMessage = MidiMessage (0x90 /* 1ch */, note, 0x7f, 0);
-        if (monologueMidiOut != nullptr)
+        for (int d = 0; d < MAX_MIDI_DEVICES; d++)
         {
-            monologueMidiOut->sendMessageNow(midiMessage);
-            noteOn[1][note] = time;
+            for (int ch = 0; ch < 16; ch++)
+            {
+                for (int note_i = 0; note_i < 128; note_i++)
+                {
+                    noteOn[d][ch][note_i] = 0;
+                }
+            }
         }
+        pending.reserve(NOTE_QUEUE_SIZE);
+        
+        startThread(10);
+    }
+    ~MidiOutManager()
+    {
+        stopThread(1000);
+        
+        // まだ送っていないノートオンは捨てて、鳴っているものだけ止める
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [] (const PendingMessage &m) { return m.isNoteOn; }), pending.end());
+        std::make_heap(pending.begin(), pending.end(), std::greater<PendingMessage>());
+        sendDueMessages(std::numeric_limits<double>::max());
     }
     
-private:
-    MidiOutManager()
+    CriticalSection deviceLock; // 開くのはメッセージスレッド、送るのは送信スレッド
+    StringArray deviceNames;
+    ScopedPointer<MidiBackend> backends[MAX_MIDI_DEVICES];
+    MidiBackendType defaultBackend = MidiBackend_Device;
+    
+    // 予約したメッセージ。時刻が一番早いものが先頭のヒープ
+    struct PendingMessage
+    {
+        double time;
+        int device;
+        int channel; // 0 - 15
+        int note;
+        int velocity;
+        bool isNoteOn;
+        int gate;          // ノートオンのとき
+        uint32 generation; // ノートオフのとき
+        double eventTime, queuedTime; // MidiTimestampに入れる
+        
+        bool operator> (const PendingMessage &other) const { return time > other.time; }
+    };
+    
+    uint32 noteOn[MAX_MIDI_DEVICES][16][128]; // ノートオンのたびに増やす。古いノートオフの予約を見分けるため
+    std::vector<PendingMessage> pending;
+    SpscQueue<NoteEvent> noteQueue;
+    Atomic<double> outputLatency[MAX_MIDI_DEVICES];
+    Atomic<double> scheduleDelay;
+    SpscQueue<CapturedMidiMessage> capture;
+    Atomic<int> captureEnabled;
+    
+    void run() override
     {
-        midiOutNames = MidiOutput::getDevices();
-        volcaMidiOut = MidiOutput::openDevice(midiOutNames.indexOf("DUO-CAPTURE EX"));
-        monologueMidiOut = MidiOutput::openDevice(midiOutNames.indexOf("monologue SOUND"));
+       #if BOUND_COUNT_ALLOCATIONS
+        AllocationCounter::ignoreThisThread(); // 予約のヒープが伸びることがある。tickのスレッドではない
+       #endif
         
-        for (int inst_i = 0; inst_i < 2; inst_i++)
+        while (! threadShouldExit())
         {
-            for (int note_i = 0; note_i < 128; note_i++)
+            NoteEvent e;
+            while (noteQueue.pop(e))
             {
-                noteOn[inst_i][note_i] = 0;
+                if (! isPositiveAndBelow(e.device, MAX_MIDI_DEVICES)) continue;
+                
+                const double now = Time::getMillisecondCounterHiRes();
+                
+                PendingMessage m;
+                m.time = e.time > 0 ? e.time + scheduleDelay.get() - outputLatency[e.device].get() : now;
+                m.device = e.device;
+                m.channel = jlimit(1, 16, e.channel) - 1;
+                m.note = e.note & 0x7f;
+                m.velocity = jlimit(1, 127, e.velocity);
+                m.isNoteOn = true;
+                m.gate = e.gate;
+                m.generation = 0;
+                m.eventTime = e.time;
+                m.queuedTime = e.queued;
+                schedule(m);
+            }
+            
+            sendDueMessages(Time::getMillisecondCounterHiRes());
+            
+            // 次の送信が近いときは寝ずに待つ
+            const double untilNext = pending.empty() ? 1.0 : pending.front().time - Time::getMillisecondCounterHiRes();
+            if (untilNext >= 1.0)
+                wait(1);
+            else
+                Thread::yield();
+        }
+    }
+    
+    void send(const PendingMessage &m, const MidiMessage &message)
+    {
+        {
+            const ScopedLock sl(deviceLock);
+            
+            if (backends[m.device] != nullptr)
+            {
+                backends[m.device]->send(message);
             }
         }
         
-        startTimer(100);
+        if (captureEnabled.get() != 0)
+        {
+            CapturedMidiMessage c;
+            c.device = m.device;
+            c.data[0] = message.getRawData()[0];
+            c.data[1] = message.getRawData()[1];
+            c.data[2] = message.getRawData()[2];
+            c.time.eventTime = m.eventTime;
+            c.time.queuedTime = m.queuedTime;
+            c.time.scheduledTime = m.time;
+            c.time.sentTime = Time::getMillisecondCounterHiRes();
+            capture.push(c);
+        }
     }
-    ~MidiOutManager() { }
     
-    StringArray midiOutNames;
-    ScopedPointer<MidiOutput> volcaMidiOut;
-    ScopedPointer<MidiOutput> monologueMidiOut;
+    void schedule(const PendingMessage &m)
+    {
+        pending.push_back(m);
+        std::push_heap(pending.begin(), pending.end(), std::greater<PendingMessage>());
+    }
     
-    int noteOn[2 /* volca minilogue */][128];
+    void sendNoteOn(const PendingMessage &m)
+    {
+        uint32 &generation = noteOn[m.device][m.channel][m.note];
+        
+        // まだ鳴っているなら先に止める。予約してあったノートオフは古くなって捨てられる
+        if (generation & 1)
+        {
+            send(m, MidiMessage(0x80 | m.channel, m.note, 0x00, 0));
+            generation++;
+        }
+        
+        send(m, MidiMessage(0x90 | m.channel, m.note, m.velocity, 0));
+        generation++;
+        
+        PendingMessage off = m;
+        off.time = m.time + m.gate;
+        off.isNoteOn = false;
+        off.generation = generation;
+        schedule(off);
+    }
     
-    void timerCallback()
+    void sendDueMessages(double now)
     {
-        //for (int inst_i = 0; inst_i < 2; inst_i++)
-        int inst_i = 1;
+        while (! pending.empty() && pending.front().time <= now)
         {
-            for (int note_i = 0; note_i < 128; note_i++)
+            std::pop_heap(pending.begin(), pending.end(), std::greater<PendingMessage>());
+            const PendingMessage m = pending.back();
+            pending.pop_back();
+            
+            if (m.isNoteOn)
             {
-                if (noteOn[inst_i][note_i] > 0)
-                {
-                    noteOn[inst_i][note_i]--;
-                }
-                else if (noteOn[inst_i][note_i] == 0)
-                {
-                    MidiMessage midiMessage = MidiMessage (0x90 /* 1ch */, note_i, 0x00, 0);
-                    if (monologueMidiOut != nullptr)
-                    {
-                        monologueMidiOut->sendMessageNow(midiMessage);
-                    }
-                }
+                sendNoteOn(m);
+                continue;
             }
+            
+            uint32 &generation = noteOn[m.device][m.channel][m.note];
+            if (generation != m.generation) continue;
+            
+            generation++;
+            send(m, MidiMessage(0x80 | m.channel, m.note, 0x00, 0));
         }
     }
-    
-#pragma mark - timer
 };
@@ -0,0 +1,154 @@
+//
+//  MidiRouting.cpp
+//  Bound - App
+//
+
+#include "MidiRouting.h"
+
+MidiRouting MidiRouting::createDefault()
+{
+    MidiRouting routing;
+    
+    Rule volca;
+    volca.board = -1;
+    volca.trackMin = 0;
+    volca.trackMax = 15;
+    volca.deviceName = "DUO-CAPTURE EX";
+    volca.channel = 0;
+    volca.note = 0;
+    volca.velocity = 0x7f;
+    volca.gate = GATETIME;
+    routing.rules.push_back(volca);
+    
+    Rule monologue;
+    monologue.board = -1;
+    monologue.trackMin = monologue.trackMax = SEQUENCE_TRACK;
+    monologue.deviceName = "monologue SOUND";
+    monologue.channel = 1;
+    monologue.note = ROUTE_NOTE_SEQUENCE;
+    monologue.velocity = 0x7f;
+    monologue.gate = GATE_UNIT_MS;
+    routing.rules.push_back(monologue);
+    
+    return routing;
+}
+
+int MidiRouting::getLaunchTrack(int numLaunched)
+{
+    return numLaunched % SEQUENCE_LAUNCH_INTERVAL == SEQUENCE_LAUNCH_INTERVAL - 1 ? SEQUENCE_TRACK : 0;
+}
+
+File MidiRouting::getDefaultFile()
+{
+    return File::getSpecialLocation(File::userApplicationDataDirectory).getChildFile("Bound").getChildFile("routing.json");
+}
+
+bool MidiRouting::loadFromFile(const File &file)
+{
+    if (! file.existsAsFile()) return false;
+    
+    return loadFromJSON(file.loadFileAsString());
+}
+
+bool MidiRouting::loadFromJSON(const String &text)
+{
+    var json;
+    if (JSON::parse(text, json).failed() || ! json.isObject()) return false;
+    
+    MidiRouting loaded;
+    loaded.scheduleDelay = json.getProperty("scheduleDelay", 0.0);
+    
+    if (auto* deviceArray = json["devices"].getArray())
+    {
+        for (auto& d : *deviceArray)
+        {
+            Device device;
+            device.name = d.getProperty("name", String()).toString();
+            device.latency = d.getProperty("latency", 0.0);
+            
+            if (device.name.isNotEmpty())
+                loaded.devices.push_back(device);
+        }
+    }
+    
+    auto* routeArray = json["routes"].getArray();
+    if (routeArray == nullptr) return false;
+    
+    for (auto& r : *routeArray)
+    {
+        Rule rule;
+        rule.board = r.getProperty("board", -1);
+        rule.deviceName = r.getProperty("device", String()).toString();
+        rule.velocity = jlimit(1, 127, (int) r.getProperty("velocity", 0x7f));
+        rule.gate = jmax(1, (int) r.getProperty("gate", GATETIME));
+        
+        const var track = r.getProperty("track", var());
+        if (track.isArray() && track.size() == 2)
+        {
+            rule.trackMin = track[0];
+            rule.trackMax = track[1];
+        }
+        else if (track.isVoid())
+        {
+            rule.trackMin = 0;
+            rule.trackMax = NUM_TRACKS - 1;
+        }
+        else
+        {
+            rule.trackMin = rule.trackMax = (int) track;
+        }
+        
+        const var channel = r.getProperty("channel", "track");
+        rule.channel = channel.isString() ? 0 : jlimit(1, 16, (int) channel);
+        
+        const var note = r.getProperty("note", 0);
+        rule.note = note.isString() ? ROUTE_NOTE_SEQUENCE : jlimit(0, 127, (int) note);
+        
+        if (rule.deviceName.isEmpty())
+            return false;
+        
+        loaded.rules.push_back(rule);
+    }
+    
+    *this = loaded;
+    return true;
+}
+
+void MidiRouting::apply(MidiOutManager &manager) const
+{
+    manager.setScheduleDelay(scheduleDelay);
+    
+    for (auto& d : devices)
+    {
+        manager.setOutputLatency(manager.openDevice(d.name), d.latency);
+    }
+}
+
+BoardRoutes MidiRouting::compile(int boardIndex, MidiOutManager &manager) const
+{
+    BoardRoutes routes;
+    
+    for (int t = 0; t < NUM_TRACKS; t++)
+    {
+        routes.begin[t] = (int) routes.targets.size();
+        
+        for (auto& rule : rules)
+        {
+            if (rule.board >= 0 && rule.board != boardIndex) continue;
+            if (t < rule.trackMin || t > rule.trackMax) continue;
+            
+            RouteTarget target;
+            target.device = manager.openDevice(rule.deviceName);
+            target.channel = rule.channel > 0 ? rule.channel : jlimit(1, 16, t + 1);
+            target.note = rule.note;
+            target.velocity = rule.velocity;
+            target.gate = rule.gate;
+            
+            if (target.device >= 0)
+                routes.targets.push_back(target);
+        }
+    }
+    
+    routes.begin[NUM_TRACKS] = (int) routes.targets.size();
+    return routes;
+}
@@ -0,0 +1,113 @@
+//
+//  MidiRouting.h
+//  Bound - App
+//
+//  どのボード・どのトラック(Ball::noteNum)の衝突を、どのデバイスのどのch・ノートで鳴らすか。
+//  設定ファイル(JSON)から読める。ゲーム中はボードごとにトラック番号で引ける表にしておく。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "MidiOutManager.h"
+#include <vector>
+
+#define NUM_TRACKS 128
+#define SEQUENCE_TRACK 16 // デフォルトの設定でmonologueのシーケンスを鳴らすトラック
+#define SEQUENCE_LAUNCH_INTERVAL 5 // 投げたボールのうちこの数に1個をSEQUENCE_TRACKにする(元は5個目のボールがmonologue)
+#define ROUTE_NOTE_SEQUENCE -1 // noteにこれを指定するとボードのシーケンスから順に鳴らす
+
+// 送り先ひとつぶん。全部解決済み
+struct RouteTarget
+{
+    int device;  // MidiOutManager::openDeviceの番号
+    int channel; // 1 - 16
+    int note;    // ROUTE_NOTE_SEQUENCEならシーケンス
+    int velocity;
+    int gate;    // ms
+};
+
+// ひとつのボードの表。トラックtの送り先はtargets[begin[t]]からtargets[begin[t + 1] - 1]まで
+struct BoardRoutes
+{
+    BoardRoutes()
+    {
+        for (int t = 0; t <= NUM_TRACKS; t++) begin[t] = 0;
+    }
+    
+    const RouteTarget* find(int track, int &num) const
+    {
+        track &= (NUM_TRACKS - 1);
+        num = begin[track + 1] - begin[track];
+        return num > 0 ? &targets[(size_t) begin[track]] : nullptr;
+    }
+    
+    // 1つのトラックの行き先の数の最大。1回の衝突で積む音の数
+    int getMaxTargetsPerTrack() const
+    {
+        int n = 0;
+        for (int t = 0; t < NUM_TRACKS; t++) n = jmax(n, begin[t + 1] - begin[t]);
+        return n;
+    }
+    
+    std::vector<RouteTarget> targets;
+    int begin[NUM_TRACKS + 1];
+};
+
+/*
+ 設定ファイルの例:
+ {
+   "scheduleDelay": 10,
+   "devices": [ { "name": "DUO-CAPTURE EX", "latency": 3 }, { "name": "monologue SOUND", "latency": 8 } ],
+   "routes": [
+     { "track": [0, 15], "device": "DUO-CAPTURE EX", "channel": "track", "note": 0, "gate": 50 },
+     { "board": 1, "track": 16, "device": "monologue SOUND", "channel": 1, "note": "sequence", "gate": 100 }
+   ]
+ }
+ boardとtrackは省略するとすべて。trackは数字か[最小, 最大]。
+ channelは"track"にするとトラック番号 + 1。noteは数字か"sequence"。
+*/
+class MidiRouting
+{
+public:
+    struct Rule
+    {
+        int board;              // -1ならすべて
+        int trackMin, trackMax;
+        String deviceName;
+        int channel;            // 0ならトラック番号 + 1
+        int note;
+        int velocity;
+        int gate;
+    };
+    
+    struct Device
+    {
+        String name;
+        double latency;
+    };
+    
+    // 元のハードコードと同じ: トラック0 - 15はvolca(DUO-CAPTURE EX)のそのch、SEQUENCE_TRACKはmonologueでシーケンス
+    static MidiRouting createDefault();
+    
+    // 投げたボールに付けるトラック。numLaunchedはそれまでに投げた数。
+    // SEQUENCE_LAUNCH_INTERVAL個目ごとにSEQUENCE_TRACK、ほかはトラック0
+    static int getLaunchTrack(int numLaunched);
+    
+    // ユーザーのアプリケーションデータのBound/routing.json
+    static File getDefaultFile();
+    
+    // 読めなかったらfalseを返して中身は変えない
+    bool loadFromFile(const File &file);
+    bool loadFromJSON(const String &json);
+    
+    // デバイスを開いてlatencyとscheduleDelayを設定する
+    void apply(MidiOutManager &manager) const;
+    
+    // boardIndexのボード用の表を作る。デバイスはここで開く(開いていれば番号を引くだけ)
+    BoardRoutes compile(int boardIndex, MidiOutManager &manager) const;
+    
+    std::vector<Rule> rules;
+    std::vector<Device> devices;
+    double scheduleDelay = 0;
+};
@@ -0,0 +1,160 @@
+//
+//  RenderPipeline.cpp
+//  Bound - App
+//
+
+#include "RenderPipeline.h"
+#include <cstring>
+
+using namespace game;
+
+#define LATENCY_SMOOTHING 0.05 // 平均に新しい値を混ぜる割合
+
+void RenderPipeline::StageLatency::add (double ms)
+{
+    const int n = count.get();
+    const double avg = n == 0 ? ms : average.get() + (ms - average.get()) * LATENCY_SMOOTHING;
+
+    last = ms;
+    average = avg;
+    if (n == 0 || ms > max.get()) max = ms;
+    count = n + 1;
+}
+
+void RenderPipeline::StageLatency::reset()
+{
+    last = 0;
+    average = 0;
+    max = 0;
+    count = 0;
+}
+
+RenderPipeline::RenderPipeline() : Thread ("Bound LED compose")
+{
+    resetLatency();
+}
+
+RenderPipeline::~RenderPipeline()
+{
+    stop();
+}
+
+void RenderPipeline::start()
+{
+    if (! isThreadRunning())
+        startThread (6);
+}
+
+void RenderPipeline::stop()
+{
+    stopThread (1000);
+}
+
+void RenderPipeline::publish (const Board* const* boards, int numBoards, int64 tickIndex, double tickTimeMs, double simulateMs)
+{
+    const double start = Time::getMillisecondCounterHiRes();
+
+    BoardSnapshot& s = snapshots.getWriteBuffer();
+    s.numBoards = jmin (numBoards, MAX_RENDER_BOARDS);
+
+    for (int b = 0; b < s.numBoards; b++)
+        std::memcpy (s.frames[b], boards[b]->getBoardFrame(), sizeof (BoardFrame));
+
+    s.tickIndex = tickIndex;
+    s.tickTimeMs = tickTimeMs;
+    s.publishTime = Time::getMillisecondCounterHiRes();
+    snapshots.publish();
+
+    latency[Stage_Simulate].add (simulateMs + (s.publishTime - start));
+    notify();
+}
+
+void RenderPipeline::run()
+{
+    while (! threadShouldExit())
+    {
+        if (! compose())
+            wait (LED_POLL_INTERVAL_MS);
+    }
+}
+
+bool RenderPipeline::compose()
+{
+    if (! snapshots.update())
+        return false;
+
+    const double start = Time::getMillisecondCounterHiRes();
+    const BoardSnapshot& s = snapshots.getReadBuffer();
+    ComposedFrame& out = composed.getWriteBuffer();
+
+    composeShouldClear = clearRequested.get() != 0;
+    if (composeShouldClear) clearRequested = 0;
+
+    composeSource = &s;
+    composeTarget = &out;
+
+    if (scheduler != nullptr)
+    {
+        scheduler->run (composeBoard, this, s.numBoards);
+    }
+    else
+    {
+        for (int b = 0; b < s.numBoards; b++)
+            composeBoard (this, b);
+    }
+
+    out.numBoards = s.numBoards;
+    out.tickIndex = s.tickIndex;
+    out.tickTimeMs = s.tickTimeMs;
+    out.publishTime = Time::getMillisecondCounterHiRes();
+    composed.publish();
+
+    latency[Stage_Compose].add (out.publishTime - start);
+
+    return true;
+}
+
+void RenderPipeline::composeBoard (void* pipeline, int b)
+{
+    RenderPipeline& p = *static_cast<RenderPipeline*> (pipeline);
+    const BoardSnapshot& s = *p.composeSource;
+    ComposedFrame& out = *p.composeTarget;
+
+    if (p.composeShouldClear) p.trails[b].clear();
+
+    p.trails[b].compose (s.frames[b]);
+    std::memcpy (out.rgb565[b], p.trails[b].getRGB565(), sizeof (out.rgb565[b]));
+    std::memcpy (out.frames[b], s.frames[b], sizeof (BoardFrame));
+}
+
+bool RenderPipeline::acquire (const ComposedFrame*& frame)
+{
+    if (! composed.update())
+        return false;
+
+    frame = &composed.getReadBuffer();
+    return true;
+}
+
+void RenderPipeline::finishedTransmit (const ComposedFrame& frame, double transmitMs)
+{
+    latency[Stage_Transmit].add (transmitMs);
+
+    if (frame.tickTimeMs > 0)
+        latency[Stage_EndToEnd].add (Time::getMillisecondCounterHiRes() - frame.tickTimeMs);
+}
+
+RenderPipeline::Latency RenderPipeline::getLatency (Stage stage) const
+{
+    Latency l;
+    l.last = latency[stage].last.get();
+    l.average = latency[stage].average.get();
+    l.max = latency[stage].max.get();
+    return l;
+}
+
+void RenderPipeline::resetLatency()
+{
+    for (int i = 0; i < Stage_Num; i++)
+        latency[i].reset();
+}
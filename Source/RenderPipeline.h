@@ -0,0 +1,119 @@
+//
+//  RenderPipeline.h
+//  Bound - App
+//
+//  LEDの描画を simulate -> compose -> transmit の3段に分ける。
+//  simulateはクロックのスレッドでボードを進めて盤面を写す。composeは専用のスレッドで残像を合成する。
+//  transmitはメッセージスレッドでブロックに送る(BLOCKSのAPIはメッセージスレッドから触る)。
+//  段の間はトリプルバッファなので、送るのが遅れても古いフレームを捨てるだけで、ゲームは待たされない。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "LEDFrameBuffer.h"
+#include "TripleBuffer.h"
+#include "TaskScheduler.h"
+
+#define MAX_RENDER_BOARDS 128 // 仮想のパッドで何十台もつなぐので多め。メモリはボード1枚あたり十数KB
+#define LED_POLL_INTERVAL_MS 20 // transmitが新しいフレームを見にいく間隔
+
+// simulate -> compose
+struct BoardSnapshot
+{
+    game::BoardFrame frames[MAX_RENDER_BOARDS];
+    int numBoards = 0;
+    int64 tickIndex = 0;
+    double tickTimeMs = 0;
+    double publishTime = 0; // 写し終わった時刻(Time::getMillisecondCounterHiRes())
+};
+
+// compose -> transmit
+struct ComposedFrame
+{
+    game::BoardFrame frames[MAX_RENDER_BOARDS]; // BallTrailProgramにはボールのマスだけ送る
+    uint16 rgb565[MAX_RENDER_BOARDS][game::LEDFrameBuffer::planeSize];
+    int numBoards = 0;
+    int64 tickIndex = 0;
+    double tickTimeMs = 0;
+    double publishTime = 0;
+};
+
+class RenderPipeline : private Thread
+{
+public:
+    enum Stage
+    {
+        Stage_Simulate,  // ボードを進めて写すまで
+        Stage_Compose,   // 残像の合成
+        Stage_Transmit,  // ブロックへの書き込み
+        Stage_EndToEnd,  // ターンの時刻から送り終わるまで
+        Stage_Num,
+    };
+
+    RenderPipeline();
+    ~RenderPipeline();
+
+    void start();
+    void stop();
+
+    /** composeをボードごとに分けてschedulerでやる。BoardWorldと同じものでいい(ボードを進めるのと同時に動ける)。
+        startの前に呼ぶこと */
+    void setScheduler (TaskScheduler* s)  { scheduler = s; }
+
+    //==============================================================================
+    /** simulate。クロックのスレッドから、ボードをロックしたまま呼ぶ。simulateMsはボードを進めるのにかかった時間 */
+    void publish (const game::Board* const* boards, int numBoards, int64 tickIndex, double tickTimeMs, double simulateMs);
+
+    /** compose。startしていないときに、publishしたフレームをこのスレッドで合成する(決定的に回すとき)。
+        新しいフレームがなければfalse */
+    bool compose();
+
+    /** transmit。メッセージスレッドから呼ぶ。新しいフレームがあればtrueでframeに入れる */
+    bool acquire (const ComposedFrame*& frame);
+
+    /** transmit。acquireしたフレームを送り終わったら、かかった時間を渡す */
+    void finishedTransmit (const ComposedFrame& frame, double transmitMs);
+
+    /** 次のcomposeで残像を消す */
+    void clearTrails()  { clearRequested = 1; }
+
+    //==============================================================================
+    struct Latency
+    {
+        double last, average, max; // ms
+    };
+
+    Latency getLatency (Stage stage) const;
+    void resetLatency();
+
+    int getNumDroppedSnapshots() const  { return snapshots.getNumDropped(); } // composeが追いつかなかった
+    int getNumDroppedFrames() const     { return composed.getNumDropped(); }  // transmitが追いつかなかった
+
+private:
+    void run() override;
+    static void composeBoard (void* pipeline, int board);
+
+    // 書くスレッドはひとつだけ
+    struct StageLatency
+    {
+        void add (double ms);
+        void reset();
+
+        Atomic<double> last, average, max;
+        Atomic<int> count;
+    };
+
+    TripleBuffer<BoardSnapshot> snapshots;
+    TripleBuffer<ComposedFrame> composed;
+    game::LEDFrameBuffer trails[MAX_RENDER_BOARDS]; // composeの間だけ触る。ボードごとに別のスレッドでもいい
+    TaskScheduler* scheduler = nullptr;
+    const BoardSnapshot* composeSource = nullptr; // composeの間だけ使う
+    ComposedFrame* composeTarget = nullptr;
+    bool composeShouldClear = false;
+    Atomic<int> clearRequested;
+    StageLatency latency[Stage_Num];
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RenderPipeline)
+};
@@ -0,0 +1,119 @@
+//
+//  SimulationClock.h
+//  Bound - App
+//
+//  ゲームを進めるための専用スレッド。
+//  メッセージスレッドのTimerだとGUIが詰まるとテンポが揺れるので、固定の刻みで別スレッドから呼ぶ。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#define DEFAULT_TICK_INTERVAL_MS 80.0
+#define DEFAULT_TICKS_PER_BEAT 4
+#define MAX_CATCH_UP_TICKS 4 // これ以上遅れたら追いつくのをあきらめて今から数えなおす
+
+class SimulationClock : private Thread
+{
+public:
+    struct Listener
+    {
+        virtual ~Listener() {}
+
+        /** Called on the clock thread once per tick. tickTimeMs is when the tick was due, not when it actually ran. */
+        virtual void simulationTick (int64 tickIndex, double tickTimeMs) = 0;
+    };
+
+    SimulationClock (Listener& l) : Thread ("Bound simulation clock"), listener (l)
+    {
+        intervalMs = DEFAULT_TICK_INTERVAL_MS;
+    }
+
+    ~SimulationClock()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        if (! isThreadRunning())
+            startThread (8);
+    }
+
+    void stop()
+    {
+        stopThread (1000);
+    }
+
+    //==============================================================================
+    /** 1拍をticksPerBeat回に分けて進める */
+    void setBpm (double bpm, int ticksPerBeat = DEFAULT_TICKS_PER_BEAT)
+    {
+        if (bpm > 0 && ticksPerBeat > 0)
+            setTickInterval (60000.0 / (bpm * ticksPerBeat));
+    }
+
+    double getBpm (int ticksPerBeat = DEFAULT_TICKS_PER_BEAT) const
+    {
+        return 60000.0 / (intervalMs.get() * ticksPerBeat);
+    }
+
+    void setTickInterval (double ms)
+    {
+        jassert (ms > 0);
+        intervalMs = ms;
+        notify();
+    }
+
+    double getTickInterval() const   { return intervalMs.get(); }
+    int64 getTickCount() const       { return tickCount.get(); }
+    int64 getNumDroppedTicks() const { return droppedTicks.get(); }
+
+private:
+    void run() override
+    {
+        double nextTick = Time::getMillisecondCounterHiRes();
+
+        while (! threadShouldExit())
+        {
+            const double interval = intervalMs.get();
+            const double now = Time::getMillisecondCounterHiRes();
+            const double remaining = nextTick - now;
+
+            if (remaining > 2.0)
+            {
+                // 寝すぎないように少し手前で起きて、残りはyieldで待つ
+                wait ((int) (remaining - 1.0));
+                continue;
+            }
+
+            if (remaining > 0)
+            {
+                Thread::yield();
+                continue;
+            }
+
+            // 遅れすぎていたら飛ばした分を数えて、今を基準にしなおす
+            if (-remaining > interval * MAX_CATCH_UP_TICKS)
+            {
+                const int64 skipped = (int64) (-remaining / interval);
+                droppedTicks += skipped;
+                nextTick += skipped * interval;
+            }
+
+            listener.simulationTick (tickCount.get(), nextTick);
+            ++tickCount;
+
+            // 実際に呼べた時刻ではなく予定の時刻から足すので、誤差がたまらない
+            nextTick += interval;
+        }
+    }
+
+    Listener& listener;
+    Atomic<double> intervalMs;
+    Atomic<int64> tickCount;
+    Atomic<int64> droppedTicks;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SimulationClock)
+};
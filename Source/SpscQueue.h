@@ -0,0 +1,60 @@
+//
+//  SpscQueue.h
+//  Bound - App
+//
+//  書き込むスレッドと読むスレッドがひとつずつのときに使うロックなしのリングバッファ。
+//  容量は最初に決めて全部確保するので、pushとpopではヒープを触らない。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include <vector>
+
+template <typename Type>
+class SpscQueue
+{
+public:
+    SpscQueue (int capacity) : fifo (capacity + 1), buffer ((size_t) capacity + 1) {}
+
+    /** Producer side. Returns false (and drops the item) if the queue is full. */
+    bool push (const Type& item)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (1, start1, size1, start2, size2);
+
+        if (size1 + size2 < 1)
+        {
+            ++numDropped;
+            return false;
+        }
+
+        buffer[(size_t) (size1 > 0 ? start1 : start2)] = item;
+        fifo.finishedWrite (1);
+        return true;
+    }
+
+    /** Consumer side. Returns false if the queue is empty. */
+    bool pop (Type& item)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (1, start1, size1, start2, size2);
+
+        if (size1 + size2 < 1)
+            return false;
+
+        item = buffer[(size_t) (size1 > 0 ? start1 : start2)];
+        fifo.finishedRead (1);
+        return true;
+    }
+
+    int getNumReady() const     { return fifo.getNumReady(); }
+    int getNumDropped() const   { return numDropped.get(); }
+
+private:
+    AbstractFifo fifo;
+    std::vector<Type> buffer;
+    Atomic<int> numDropped;
+
+    JUCE_DECLARE_NON_COPYABLE (SpscQueue)
+};
@@ -0,0 +1,208 @@
+//
+//  TaskScheduler.cpp
+//  Bound - App
+//
+
+#include "TaskScheduler.h"
+
+class TaskScheduler::Worker : public Thread
+{
+public:
+    Worker (TaskScheduler& s, int i) : Thread ("Bound worker " + String (i)), scheduler (s), index (i) {}
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            wait (-1); // runがnotifyするまで寝る
+            if (threadShouldExit()) break;
+
+            scheduler.workAll (index);
+        }
+    }
+
+private:
+    TaskScheduler& scheduler;
+    const int index;
+};
+
+TaskScheduler::TaskScheduler (int numThreads)
+{
+    setNumThreads (numThreads);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    stopWorkers();
+}
+
+void TaskScheduler::stopWorkers()
+{
+    for (auto* w : workers)
+    {
+        w->signalThreadShouldExit();
+        w->notify();
+        w->stopThread (1000);
+    }
+
+    workers.clear();
+}
+
+void TaskScheduler::setNumThreads (int n)
+{
+    // 全部のグループを押さえて、動いているrunが終わるのを待つ
+    for (auto& g : groups)
+        while (! g.busy.compareAndSetBool (1, 0))
+            Thread::yield();
+
+    if (n <= 0) n = SystemStats::getNumCpus();
+    n = jmax (1, n);
+
+    stopWorkers();
+
+    numQueues = n;
+    queues.allocate ((size_t) (MAX_TASK_GROUPS * numQueues), true);
+
+    // 0番はrunを呼んだスレッド
+    for (int i = 1; i < numQueues; i++)
+        workers.add (new Worker (*this, i))->startThread (8);
+
+    for (auto& g : groups)
+        g.busy = 0;
+}
+
+int TaskScheduler::acquireGroup()
+{
+    for (int g = 0; g < MAX_TASK_GROUPS; g++)
+        if (groups[g].busy.compareAndSetBool (1, 0))
+            return g;
+
+    return -1;
+}
+
+bool TaskScheduler::popOwn (int g, int q, int& task)
+{
+    Queue& queue = getQueue (g, q);
+    const SpinLock::ScopedLockType sl (queue.lock);
+
+    if (queue.begin >= queue.end)
+        return false;
+
+    // 自分は前から取る。となりの添字は同じボードの続きなことが多い
+    task = queue.begin++;
+    return true;
+}
+
+bool TaskScheduler::steal (int g, int thief, int& task)
+{
+    // 同じグループの中で、となりから順に見ていく
+    for (int k = 1; k < numQueues; k++)
+    {
+        Queue& victim = getQueue (g, (thief + k) % numQueues);
+        int begin, end;
+
+        {
+            const SpinLock::ScopedLockType sl (victim.lock);
+
+            if (victim.begin >= victim.end)
+                continue;
+
+            // 後ろ半分をもらう。残りが1つならそれだけ
+            const int mid = victim.begin + (victim.end - victim.begin) / 2;
+            begin = mid;
+            end = victim.end;
+            victim.end = mid;
+        }
+
+        ++numSteals;
+        task = begin;
+
+        if (end - begin > 1)
+        {
+            Queue& own = getQueue (g, thief);
+            const SpinLock::ScopedLockType sl (own.lock);
+            own.begin = begin + 1;
+            own.end = end;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool TaskScheduler::work (int g, int q)
+{
+    Group& group = groups[g];
+    bool didWork = false;
+    int task;
+
+    while (popOwn (g, q, task) || steal (g, q, task))
+    {
+        // functionとcontextはキューを詰める前に書いてあるので、タスクを取れたなら今のrunのもの
+        group.function (group.context, task);
+        didWork = true;
+
+        if (--group.remaining == 0)
+            group.finished.signal();
+    }
+
+    return didWork;
+}
+
+void TaskScheduler::workAll (int q)
+{
+    // 動いているグループを順に手伝う。ひとつも取れなくなったら寝る。
+    // 見ている間に積まれたrunのnotifyは残っているので、寝てもすぐ起きる
+    for (;;)
+    {
+        bool didWork = false;
+
+        for (int g = 0; g < MAX_TASK_GROUPS; g++)
+            if (groups[g].busy.get() != 0)
+                didWork = work (g, q) || didWork;
+
+        if (! didWork)
+            return;
+    }
+}
+
+void TaskScheduler::run (TaskFunction fn, void* ctx, int numTasks)
+{
+    if (numTasks <= 0)
+        return;
+
+    const int g = numQueues == 1 || numTasks == 1 ? -1 : acquireGroup();
+
+    if (g < 0)
+    {
+        for (int i = 0; i < numTasks; i++)
+            fn (ctx, i);
+
+        return;
+    }
+
+    Group& group = groups[g];
+    group.function = fn;
+    group.context = ctx;
+    group.remaining = numTasks;
+    group.finished.reset();
+
+    // 連続した範囲に分けて配る。重さの偏りは盗み合いでならす
+    for (int q = 0; q < numQueues; q++)
+    {
+        Queue& queue = getQueue (g, q);
+        const SpinLock::ScopedLockType ql (queue.lock);
+        queue.begin = (int) ((int64) numTasks * q / numQueues);
+        queue.end = (int) ((int64) numTasks * (q + 1) / numQueues);
+    }
+
+    for (auto* w : workers)
+        w->notify();
+
+    // 呼んだスレッドは自分のグループだけ手伝う。ほかのrunの重いタスクを拾って遅れないように
+    work (g, 0);
+    group.finished.wait();
+
+    group.busy = 0;
+}
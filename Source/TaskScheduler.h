@@ -0,0 +1,81 @@
+//
+//  TaskScheduler.h
+//  Bound - App
+//
+//  ワークスティーリングのタスクスケジューラ。
+//  run(n)で0 .. n-1のタスクをスレッドごとのキューに区切って配り、自分のキューが空になったスレッドは
+//  ほかのスレッドのキューの後ろ半分を盗む。ボールの多いボードのように重さがばらばらなタスクでも、コアが遊ばない。
+//  runを呼んだスレッドも一緒に働く。タスクの中身はキューに積まず添字だけ配るので、runの中ではヒープを触らない。
+//  ボードを進めるスレッドと残像を合成するスレッドが同じものを使うので、runは別々のスレッドから同時に呼んでいい。
+//  runごとにグループ(キューの組)をひとつ使い、ワーカーは動いているグループを順に手伝う。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+
+#define MAX_TASK_GROUPS 4 // 同時に動けるrunの数。これより多いときは呼んだスレッドだけでやる
+
+class TaskScheduler
+{
+public:
+    typedef void (*TaskFunction) (void* context, int taskIndex);
+    
+    /** numThreadsには呼んだスレッドも入る。0ならCPUの数 */
+    explicit TaskScheduler (int numThreads = 0);
+    ~TaskScheduler();
+    
+    void setNumThreads (int numThreads);
+    int getNumThreads() const  { return numQueues; }
+    
+    /** function(context, i)を0 <= i < numTasksについて呼び、全部終わってから返る。
+        ほかのスレッドがrunしている最中に呼んでもいい。MAX_TASK_GROUPS個ふさがっていたら、呼んだスレッドだけで順に実行する */
+    void run (TaskFunction function, void* context, int numTasks);
+    
+    /** fn(i)を並列に呼ぶ。fnは終わるまで生きていること */
+    template <typename Fn>
+    void parallelFor (int numTasks, Fn& fn)
+    {
+        run ([] (void* c, int i) { (*static_cast<Fn*> (c)) (i); }, &fn, numTasks);
+    }
+    
+    /** 盗んだ回数(累計) */
+    int64 getNumSteals() const  { return numSteals.get(); }
+
+private:
+    class Worker;
+    
+    struct Queue
+    {
+        SpinLock lock;
+        int begin = 0, end = 0; // まだ誰も取っていないタスク
+    };
+    
+    // ひとつのrun。キューはqueuesのgroup * numQueuesから
+    struct Group
+    {
+        Atomic<int> busy;    // runが使っている
+        TaskFunction function = nullptr;
+        void* context = nullptr;
+        Atomic<int> remaining;
+        WaitableEvent finished;
+    };
+    
+    Queue& getQueue (int group, int queue)  { return queues[group * numQueues + queue]; }
+    
+    bool popOwn (int group, int queue, int& task);
+    bool steal (int group, int thief, int& task);
+    bool work (int group, int queue);
+    void workAll (int queue);
+    int acquireGroup();
+    void stopWorkers();
+    
+    HeapBlock<Queue> queues; // MAX_TASK_GROUPS * numQueues
+    int numQueues = 0;
+    OwnedArray<Worker> workers;
+    
+    Group groups[MAX_TASK_GROUPS];
+    Atomic<int64> numSteals;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TaskScheduler)
+};
@@ -0,0 +1,59 @@
+//
+//  TripleBuffer.h
+//  Bound - App
+//
+//  書くスレッドと読むスレッドがひとつずつのときのロックなしのトリプルバッファ。
+//  書く側は待たずにいつでも次を書けて、読む側はいつも一番新しいものだけを受け取る。
+//  読まれる前に上書きされたものは捨てたことになる(古いフレームは送らない)。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include <atomic>
+
+template <typename Type>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : middle (1), back (0), front (2) {}
+
+    /** Producer side. Fill this in, then call publish(). */
+    Type& getWriteBuffer()  { return slots[back]; }
+
+    /** Producer side. Makes the write buffer the newest frame and hands back a free one. */
+    void publish()
+    {
+        const int previous = middle.exchange (back | dirtyBit, std::memory_order_acq_rel);
+        back = previous & indexMask;
+
+        if (previous & dirtyBit)
+            ++numDropped;
+    }
+
+    /** Consumer side. Returns true if a newer frame than the last one is now in getReadBuffer(). */
+    bool update()
+    {
+        if ((middle.load (std::memory_order_acquire) & dirtyBit) == 0)
+            return false;
+
+        front = middle.exchange (front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    /** Consumer side. */
+    const Type& getReadBuffer() const  { return slots[front]; }
+
+    /** 読まれずに上書きされた数 */
+    int getNumDropped() const  { return numDropped.get(); }
+
+private:
+    enum { indexMask = 3, dirtyBit = 4 };
+
+    Type slots[3];
+    std::atomic<int> middle; // 受け渡し中の添字。dirtyBitが立っていたらまだ読まれていない
+    int back, front;         // 書く側だけ、読む側だけが触る
+    Atomic<int> numDropped;
+
+    JUCE_DECLARE_NON_COPYABLE (TripleBuffer)
+};
@@ -0,0 +1,226 @@
+//
+//  VirtualTopology.cpp
+//  Bound - App
+//
+
+#include "VirtualTopology.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace game;
+
+VirtualLightpad::VirtualLightpad (int i, int x, int y)
+    : index (i), gridX (x), gridY (y),
+      captured ((size_t) MAX_CAPTURED_FRAMES * LEDFrameBuffer::planeSize)
+{
+    clearCapture();
+}
+
+void VirtualLightpad::clearCapture()
+{
+    std::memset (current, 0, sizeof (current));
+    numCaptured = 0;
+    newest = -1;
+    numFramesReceived = 0;
+    pixelsChangedLastFrame = 0;
+    totalPixelsChanged = 0;
+    checksum = 2166136261u; // FNV-1a
+}
+
+void VirtualLightpad::receiveFrame (const uint16* pixels, int64 tickIndex)
+{
+    int changed = 0;
+
+    for (int i = 0; i < LEDFrameBuffer::numPixels; i++)
+    {
+        if (current[i] != pixels[i])
+        {
+            current[i] = pixels[i];
+            changed++;
+        }
+
+        checksum = (checksum ^ (pixels[i] & 0xff)) * 16777619u;
+        checksum = (checksum ^ (pixels[i] >> 8)) * 16777619u;
+    }
+
+    newest = (newest + 1) % MAX_CAPTURED_FRAMES;
+    std::memcpy (&captured[(size_t) newest * LEDFrameBuffer::planeSize], current, sizeof (current));
+    capturedTicks[newest] = tickIndex;
+    numCaptured = jmin (numCaptured + 1, (int) MAX_CAPTURED_FRAMES);
+
+    pixelsChangedLastFrame = changed;
+    totalPixelsChanged += changed;
+    numFramesReceived++;
+}
+
+const uint16* VirtualLightpad::getCapturedFrame (int age, int64* tickIndex) const
+{
+    if (! isPositiveAndBelow (age, numCaptured))
+        return nullptr;
+
+    const int slot = (newest - age + MAX_CAPTURED_FRAMES) % MAX_CAPTURED_FRAMES;
+
+    if (tickIndex != nullptr)
+        *tickIndex = capturedTicks[slot];
+
+    return &captured[(size_t) slot * LEDFrameBuffer::planeSize];
+}
+
+//==============================================================================
+VirtualTopologySource::VirtualTopologySource (int numPads, int padsPerRow)
+{
+    setNumPads (numPads, padsPerRow);
+}
+
+void VirtualTopologySource::setNumPads (int numPads, int padsPerRow)
+{
+    padsPerRow = jmax (1, padsPerRow);
+    pads.clear();
+
+    for (int i = 0; i < numPads; i++)
+        pads.add (new VirtualLightpad (i, i % padsPerRow, i / padsPerRow));
+
+    listeners.call (&Listener::virtualTopologyChanged);
+}
+
+void VirtualTopologySource::addEvent (double timeMs, int pad, EventType type, float x, float y, float z)
+{
+    Event e;
+    e.timeMs = timeMs;
+    e.pad = pad;
+    e.type = type;
+    e.x = x;
+    e.y = y;
+    e.z = z;
+
+    if (! events.empty() && events.back().timeMs > timeMs)
+        needsSort = true;
+
+    events.push_back (e);
+}
+
+void VirtualTopologySource::addTouch (double timeMs, int pad, float x, float y, float z)
+{
+    addEvent (timeMs, pad, Event_Touch, x, y, z);
+}
+
+void VirtualTopologySource::addButton (double timeMs, int pad, bool isDown)
+{
+    addEvent (timeMs, pad, isDown ? Event_ButtonDown : Event_ButtonUp, 0, 0, 0);
+}
+
+void VirtualTopologySource::addFlick (double timeMs, int pad, float fromX, float fromY, float toX, float toY, double durationMs, int steps)
+{
+    steps = jmax (1, steps);
+
+    for (int s = 0; s <= steps; s++)
+    {
+        const float t = (float) s / steps;
+        addTouch (timeMs + durationMs * t, pad, fromX + (toX - fromX) * t, fromY + (toY - fromY) * t, 1.0f);
+    }
+
+    // 離したところ(toX, toY)から投げる
+    addTouch (timeMs + durationMs, pad, toX, toY, 0);
+}
+
+void VirtualTopologySource::addRandomFlicks (int64 seed, double flicksPerSecond, double lengthMs)
+{
+    if (flicksPerSecond <= 0 || lengthMs <= 0)
+        return;
+
+    Random random (seed);
+    const double interval = 1000.0 / flicksPerSecond;
+
+    for (int p = 0; p < pads.size(); p++)
+    {
+        // パッドごとにずらして、全部が同じ時刻に押さないようにする
+        for (double t = random.nextDouble() * interval; t < lengthMs; t += interval * (0.5 + random.nextDouble()))
+        {
+            const float fromX = (float) random.nextInt (BLOCKS_SIZE), fromY = (float) random.nextInt (BLOCKS_SIZE);
+            const float toX = (float) random.nextInt (BLOCKS_SIZE),   toY = (float) random.nextInt (BLOCKS_SIZE);
+            addFlick (t, p, fromX, fromY, toX, toY, 60.0 + random.nextDouble() * 140.0);
+        }
+    }
+}
+
+bool VirtualTopologySource::loadScript (const File& file)
+{
+    if (! file.existsAsFile())
+        return false;
+
+    StringArray lines;
+    file.readLines (lines);
+    return loadScript (lines);
+}
+
+bool VirtualTopologySource::loadScript (const StringArray& lines)
+{
+    bool ok = true;
+
+    for (int n = 0; n < lines.size(); n++)
+    {
+        const String line = lines[n].upToFirstOccurrenceOf ("#", false, false).trim();
+        if (line.isEmpty()) continue;
+
+        StringArray tokens;
+        tokens.addTokens (line, " \t", "");
+        tokens.removeEmptyStrings();
+
+        const double timeMs = tokens[0].getDoubleValue();
+        const String& command = tokens[1];
+        const int pad = tokens[2].getIntValue();
+
+        if (command == "touch" && tokens.size() >= 6)
+            addTouch (timeMs, pad, tokens[3].getFloatValue(), tokens[4].getFloatValue(), tokens[5].getFloatValue());
+        else if (command == "button" && tokens.size() >= 4)
+            addButton (timeMs, pad, tokens[3] == "down");
+        else if (command == "flick" && tokens.size() >= 8)
+            addFlick (timeMs, pad, tokens[3].getFloatValue(), tokens[4].getFloatValue(),
+                      tokens[5].getFloatValue(), tokens[6].getFloatValue(), tokens[7].getDoubleValue());
+        else
+        {
+            DBG ("VirtualTopologySource: can't parse line " << (n + 1) << ": " << line);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+void VirtualTopologySource::clearScript()
+{
+    events.clear();
+    nextEvent = 0;
+    needsSort = false;
+}
+
+int VirtualTopologySource::advance (double elapsedMs)
+{
+    if (needsSort)
+    {
+        std::stable_sort (events.begin() + nextEvent, events.end(),
+                          [] (const Event& a, const Event& b) { return a.timeMs < b.timeMs; });
+        needsSort = false;
+    }
+
+    int delivered = 0;
+
+    while (nextEvent < (int) events.size() && events[(size_t) nextEvent].timeMs <= elapsedMs)
+    {
+        const Event& e = events[(size_t) nextEvent++];
+
+        auto* pad = pads[e.pad];
+        if (pad == nullptr) continue;
+
+        switch (e.type)
+        {
+            case Event_Touch:      listeners.call (&Listener::virtualTouchChanged, *pad, e.x, e.y, e.z); break;
+            case Event_ButtonDown: listeners.call (&Listener::virtualButtonPressed, *pad); break;
+            case Event_ButtonUp:   listeners.call (&Listener::virtualButtonReleased, *pad); break;
+        }
+
+        delivered++;
+    }
+
+    return delivered;
+}
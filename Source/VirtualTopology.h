@@ -0,0 +1,150 @@
+//
+//  VirtualTopology.h
+//  Bound - App
+//
+//  実機なしで動かすための仮想のLightpad。
+//  台本どおりにタッチとボタンを送り、送られてきたLEDのフレームを覚えておく。
+//  Blockを実装するのではなく、HeadlessEngineがPhysicalTopologySourceと並べて扱う(touchChangedとtransmitの口は同じ)。
+//  何十台つないでもいいように、パッドは盤面1枚ぶんのRGB565を受け取るだけにしてある。
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include "Game.h"
+#include "LEDFrameBuffer.h"
+#include <vector>
+
+#define MAX_CAPTURED_FRAMES 64 // パッドごとに覚えておくフレームの数。古いものから捨てる
+
+class VirtualLightpad
+{
+public:
+    VirtualLightpad (int index, int gridX, int gridY);
+    
+    int getIndex() const  { return index; }
+    int getGridX() const  { return gridX; } // 並べたときの位置(パッド単位)
+    int getGridY() const  { return gridY; }
+    
+    //==============================================================================
+    /** LEDのシンク。pixelsはRGB565、[x * BLOCKS_SIZE + y]。実機のLEDTransportと同じように変わったマスを数える */
+    void receiveFrame (const uint16* pixels, int64 tickIndex);
+    
+    int64 getNumFramesReceived() const    { return numFramesReceived; }
+    int getPixelsChangedLastFrame() const { return pixelsChangedLastFrame; }
+    int64 getTotalPixelsChanged() const   { return totalPixelsChanged; }
+    
+    /** 覚えているフレームの数 */
+    int getNumCapturedFrames() const      { return numCaptured; }
+    
+    /** 新しいほうからage番目(0が最新)のフレーム。なければnullptr */
+    const uint16* getCapturedFrame (int age, int64* tickIndex = nullptr) const;
+    
+    /** 今光っている色(最新のフレーム) */
+    uint16 getPixel (int x, int y) const  { return current[x * BLOCKS_SIZE + y]; }
+    
+    /** 受け取った全部のフレームから作るハッシュ。HeadlessEngine::runTicksで回せば同じ台本と種で同じ値になるので、
+        回帰テストで前の結果と比べる */
+    uint32 getChecksum() const            { return checksum; }
+    
+    void clearCapture();
+
+private:
+    int index, gridX, gridY;
+    
+    uint16 current[game::LEDFrameBuffer::planeSize];
+    std::vector<uint16> captured;      // [MAX_CAPTURED_FRAMES][planeSize]のリング
+    int64 capturedTicks[MAX_CAPTURED_FRAMES];
+    int numCaptured = 0, newest = -1;
+    
+    int64 numFramesReceived = 0;
+    int pixelsChangedLastFrame = 0;
+    int64 totalPixelsChanged = 0;
+    uint32 checksum;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VirtualLightpad)
+};
+
+//==============================================================================
+class VirtualTopologySource
+{
+public:
+    struct Listener
+    {
+        virtual ~Listener() {}
+        
+        /** パッドが増えたり減ったりした */
+        virtual void virtualTopologyChanged() = 0;
+        
+        /** x, yはLEDのマス(0 - BLOCKS_SIZE - 1)、zは押す強さ(0 - 1)。0で離した */
+        virtual void virtualTouchChanged (VirtualLightpad&, float x, float y, float z) = 0;
+        
+        virtual void virtualButtonPressed (VirtualLightpad&) {}
+        virtual void virtualButtonReleased (VirtualLightpad&) {}
+    };
+    
+    /** numPads台をpadsPerRow台ずつ並べる */
+    VirtualTopologySource (int numPads = 0, int padsPerRow = 8);
+    
+    void addListener (Listener* l)     { listeners.add (l); }
+    void removeListener (Listener* l)  { listeners.remove (l); }
+    
+    void setNumPads (int numPads, int padsPerRow);
+    int getNumPads() const                 { return pads.size(); }
+    VirtualLightpad* getPad (int i) const  { return pads[i]; }
+    
+    //==============================================================================
+    // 台本。時刻はrewindしてからのms
+    void addTouch (double timeMs, int pad, float x, float y, float z);
+    void addButton (double timeMs, int pad, bool isDown);
+    
+    /** 押して(fromX, fromY)から(toX, toY)まで引っ張り、durationMs後に離す。途中の位置もsteps回送る */
+    void addFlick (double timeMs, int pad, float fromX, float fromY, float toX, float toY, double durationMs, int steps = 4);
+    
+    /** 全部のパッドに、1秒あたりflicksPerSecond回ぐらいのフリックをlengthMsのあいだ散らす */
+    void addRandomFlicks (int64 seed, double flicksPerSecond, double lengthMs);
+    
+    /** 1行ずつ、#から後ろはコメント
+        <ms> touch <pad> <x> <y> <z>
+        <ms> button <pad> down|up
+        <ms> flick <pad> <fromX> <fromY> <toX> <toY> <durationMs> */
+    bool loadScript (const File& file);
+    bool loadScript (const StringArray& lines);
+    
+    void clearScript();
+    int getNumEvents() const           { return (int) events.size(); }
+    int getNumEventsDelivered() const  { return nextEvent; }
+    
+    /** elapsedMsまでのイベントを送る。BLOCKSと同じくメッセージスレッドから呼ぶ。送った数を返す */
+    int advance (double elapsedMs);
+    
+    /** 台本を頭に戻す */
+    void rewind()  { nextEvent = 0; }
+
+private:
+    enum EventType
+    {
+        Event_Touch,
+        Event_ButtonDown,
+        Event_ButtonUp,
+    };
+    
+    struct Event
+    {
+        double timeMs;
+        int pad;
+        EventType type;
+        float x, y, z;
+    };
+    
+    void addEvent (double timeMs, int pad, EventType type, float x, float y, float z);
+    
+    OwnedArray<VirtualLightpad> pads;
+    ListenerList<Listener> listeners;
+    
+    std::vector<Event> events; // 時刻順。同じ時刻なら足した順
+    int nextEvent = 0;
+    bool needsSort = false;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VirtualTopologySource)
+};